@@ -0,0 +1,252 @@
+/**
+ * A bit-sliced index over many bloom filters of the same shape (bits,
+ * hashes, hash function and hash seed), answering "which filters may contain
+ * this key" with k row reads instead of k reads per filter.
+ *
+ * Bit position p of every member filter is stored contiguously as row p, one
+ * bit per member slot. A query ANDs the k rows its key hashes to; the set
+ * bits of the result are the members which may contain the key. Members can
+ * be added (into a free slot, growing the rows when none is left) and
+ * removed. save() writes the index to a file that open() maps read-only.
+ */
+
+#ifndef BIT_SLICED_INDEX_H_
+#define BIT_SLICED_INDEX_H_
+
+#include "BloomFilter.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+class BitSlicedIndex {
+ public:
+  /** constructor: an empty index for bloom filters shaped like `shape`,
+   * with room for `capacity` members before the rows grow. */
+  explicit BitSlicedIndex(const BloomFilter &shape, size_t capacity = 64)
+      : m_bits(shape.size()), m_hashes(shape.num_hashes()),
+        m_seed(shape.hash_seed()), m_hash_id(shape.hash()) {
+    if (bloom_hash_function(m_hash_id) == nullptr) {
+      throw std::runtime_error("Hash function not available");
+    }
+    resize(std::max<size_t>(1, (capacity + 63) / 64));
+  }
+
+  /** Map an index written by save() read-only; add() and remove() throw. */
+  static BitSlicedIndex open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Failed to open " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(Header)) {
+      ::close(fd);
+      throw std::runtime_error("Invalid bit-sliced index " + path);
+    }
+    size_t len = (size_t) st.st_size;
+    void *map = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) throw std::runtime_error("Failed to map " + path);
+    std::shared_ptr<void> mapping(map, [len](void *p) { munmap(p, len); });
+
+    Header h;
+    std::memcpy(&h, map, sizeof(h));
+    if (h.magic != MAGIC || h.version != VERSION ||
+        bloom_hash_function(h.hash_id) == nullptr || h.words == 0 ||
+        len != sizeof(Header) + (h.bits + 1) * h.words * sizeof(uint64_t)) {
+      throw std::runtime_error("Invalid bit-sliced index " + path);
+    }
+    BitSlicedIndex index(h);
+    auto *words = (const uint64_t *) ((const char *) map + sizeof(Header));
+    index.m_active.assign(words, words + h.words);
+    for (uint64_t w : index.m_active) index.m_members += __builtin_popcountll(w);
+    index.m_mapped_rows = words + h.words;
+    index.m_mapping = std::move(mapping);
+#ifdef MADV_RANDOM
+    madvise(map, len, MADV_RANDOM);
+#endif
+    return index;
+  }
+
+  /** Write this index to `path` (host byte order), for open(). */
+  void save(const std::string &path) const {
+    Header h{MAGIC, VERSION, (uint16_t) m_hash_id, (uint32_t) m_hashes,
+             m_seed, (uint64_t) m_bits, (uint64_t) m_words};
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (fp == nullptr) throw std::runtime_error("Failed to create " + path);
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+              fwrite(m_active.data(), sizeof(uint64_t), m_words, fp) == m_words &&
+              fwrite(rows(), sizeof(uint64_t), m_bits * m_words, fp) ==
+                  m_bits * m_words;
+    if (fclose(fp) != 0 || !ok) {
+      throw std::runtime_error("Failed to write " + path);
+    }
+  }
+
+  /** Add a member; returns its id, the lowest free slot. */
+  size_t add(const BloomFilter &bf) {
+    if (m_mapping) throw std::runtime_error("Bit-sliced index is read-only");
+    if (bf.size() != m_bits || bf.num_hashes() != m_hashes ||
+        bf.hash_seed() != m_seed || bf.hash() != m_hash_id) {
+      throw std::runtime_error("Bloom filter shapes mismatch!");
+    }
+    size_t id = 0;
+    while (id < m_words * 64 && test(m_active.data(), id)) ++id;
+    if (id == m_words * 64) resize(2 * m_words);
+
+    const size_t word = id / 64;
+    const uint64_t mask = 1ull << (id % 64);
+    const unsigned char *bitmap = bf.bitmap();
+    for (size_t byte = 0; byte < bf.byte_size(); ++byte) {
+      for (unsigned c = bitmap[byte]; c != 0; c &= c - 1) {
+        size_t pos = byte * 8 + __builtin_ctz(c);
+        m_rows[pos * m_words + word] |= mask;
+      }
+    }
+    m_active[word] |= mask;
+    m_members++;
+    return id;
+  }
+
+  /** Remove member `id`; its slot is reused by the next add(). */
+  void remove(size_t id) {
+    if (m_mapping) throw std::runtime_error("Bit-sliced index is read-only");
+    if (id >= m_words * 64 || !test(m_active.data(), id)) {
+      throw std::runtime_error("No such member");
+    }
+    const size_t word = id / 64;
+    const uint64_t mask = ~(1ull << (id % 64));
+    for (size_t pos = 0; pos < m_bits; ++pos) m_rows[pos * m_words + word] &= mask;
+    m_active[word] &= mask;
+    m_members--;
+  }
+
+  /** Bitmap (bit `id` of word id / 64) of the members which may contain a
+   * key hashed with BloomFilter::key_hash() of a member. */
+  std::vector<uint64_t> query(const KeyHash &h) const {
+    if (h.seed != m_seed || h.hash_id != m_hash_id) {
+      throw std::runtime_error("Key hashed with another hash or seed");
+    }
+    const uint64_t *base = rows();
+    std::vector<const uint64_t *> rows(m_hashes);
+    for (size_t i = 0; i < m_hashes; ++i) {
+      rows[i] = base + ((size_t) h.a + i * (size_t) h.b) % m_bits * m_words;
+      __builtin_prefetch(rows[i]);
+    }
+    std::vector<uint64_t> out(m_active);
+    uint64_t *__restrict dst = out.data();
+    for (size_t i = 0; i < m_hashes; ++i) {
+      const uint64_t *__restrict src = rows[i];
+      uint64_t any = 0;
+      // plain word loop, vectorized by the compiler
+      for (size_t w = 0; w < m_words; ++w) {
+        dst[w] &= src[w];
+        any |= dst[w];
+      }
+      if (any == 0) break;
+    }
+    return out;
+  }
+
+  template<typename T>
+  std::vector<uint64_t> query(const T key) const {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    return query(hash((const char *) &key, sizeof(key)));
+  }
+
+  std::vector<uint64_t> query(const std::string &key) const {
+    return query(hash(key.c_str(), key.size()));
+  }
+
+  /** Ids of the members which may contain `key`, in increasing order. */
+  template<typename K>
+  std::vector<size_t> matches(const K &key) const {
+    std::vector<size_t> ids;
+    std::vector<uint64_t> bitmap = query(key);
+    for (size_t w = 0; w < bitmap.size(); ++w) {
+      for (uint64_t bits = bitmap[w]; bits != 0; bits &= bits - 1) {
+        ids.push_back(w * 64 + __builtin_ctzll(bits));
+      }
+    }
+    return ids;
+  }
+
+  /** Return the number of members. */
+  inline size_t members() const { return m_members; }
+
+  /** Return the number of member slots (a multiple of 64). */
+  inline size_t capacity() const { return m_words * 64; }
+
+  /** Return whether `id` is a member. */
+  inline bool contains_member(size_t id) const {
+    return id < m_words * 64 && test(m_active.data(), id);
+  }
+
+ private:
+  static const uint32_t MAGIC = 0x58495342;  // "BSIX"
+  static const uint16_t VERSION = 1;
+
+  struct Header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t hash_id;
+    uint32_t hashes;
+    uint32_t seed;
+    uint64_t bits;
+    uint64_t words;   // 64-bit words per row
+  };
+
+  explicit BitSlicedIndex(const Header &h)
+      : m_bits(h.bits), m_hashes(h.hashes), m_seed(h.seed),
+        m_hash_id((bloom_hash) h.hash_id), m_words(h.words) {}
+
+  static inline bool test(const uint64_t *words, size_t id) {
+    return (words[id / 64] >> (id % 64)) & 1u;
+  }
+
+  inline const uint64_t *rows() const {
+    return m_mapping ? m_mapped_rows : m_rows.data();
+  }
+
+  KeyHash hash(const char *key, size_t len) const {
+    bloom_hash_fn fn = bloom_hash_function(m_hash_id);
+    KeyHash h;
+    h.a = fn(key, (int) len, m_seed);
+    h.b = fn(key, (int) len, h.a);
+    h.seed = m_seed;
+    h.hash_id = m_hash_id;
+    return h;
+  }
+
+  /** Re-layout the rows with `words` words each. */
+  void resize(size_t words) {
+    std::vector<uint64_t> rows(m_bits * words, 0);
+    for (size_t pos = 0; pos < m_bits && m_words > 0; ++pos) {
+      std::copy(&m_rows[pos * m_words], &m_rows[pos * m_words] + m_words,
+                &rows[pos * words]);
+    }
+    m_rows.swap(rows);
+    m_active.resize(words, 0);
+    m_words = words;
+  }
+
+  size_t m_bits;
+  size_t m_hashes;
+  unsigned m_seed;
+  bloom_hash m_hash_id;
+  size_t m_words = 0;
+  size_t m_members = 0;
+  std::vector<uint64_t> m_active;  // bitmap of the member slots in use
+  std::vector<uint64_t> m_rows;    // m_bits rows of m_words words
+  // set by open(): the rows are read from the mapping
+  std::shared_ptr<void> m_mapping;
+  const uint64_t *m_mapped_rows = nullptr;
+};
+
+#endif // BIT_SLICED_INDEX_H_
@@ -9,11 +9,18 @@
 #define BLOOM_FILTER_H_
 
 #include "BitUtil.h"
+#include "NtHash.h"
 #include "bloom.h"
+#include "bloom_probes.h"
+#include <algorithm>
 #include <cmath>
 #include <stdexcept>
+#include <string>
 #include <type_traits>
+#include <vector>
 
+/** The hashes of one key, see bloom_hash_key(). */
+typedef bloom_key_hash KeyHash;
 
 class BloomFilter {
  public:
@@ -29,6 +36,28 @@ class BloomFilter {
 #endif
   }
 
+  /** constructor: hashing with `hash` instead of the default hash. */
+  BloomFilter(size_t items, double error, bloom_hash hash,
+              unsigned int hashSeed = 0u)
+      : BloomFilter(items, error, hashSeed) {
+    // the delegated constructor has completed, so the destructor cleans up
+    if (bloom_set_hash(&m_bf, hash) != 0) {
+      throw std::runtime_error("Hash function not available");
+    }
+  }
+
+  /** constructor: with the bitmap allocated as `alloc` (see enum
+   * bloom_alloc), e.g. BLOOM_ALLOC_MMAP for large filters that are reset
+   * often. Copies of it are allocated on the heap. */
+  BloomFilter(size_t items, double error, bloom_alloc alloc,
+              unsigned int hashSeed = 0u): m_bf() {
+    if (bloom_init_alloc(&m_bf, items, error, BLOOM_SIZING_OPTIMAL, alloc) !=
+        0) {
+      throw std::runtime_error("Failed to initialize the bloom");
+    }
+    set_hash_seed(hashSeed);
+  }
+
   /** constructor: from an existing bitmap (storing using unsigned char).
    * 
    * This constructor is designed for using in the cases where you need to transmit a
@@ -39,6 +68,9 @@ class BloomFilter {
    * 
    * NOTE THAT, the `raw_bf` will be moved, i.e., its memory will be re-used. If you can 
    * only copy, then the next constructor is your choice.
+   *
+   * serialize_compressed() and deserialize() ship the parameters along with
+   * the bitmap, and compress lightly loaded filters.
   */
   BloomFilter(size_t items, double error, unsigned char *&raw_bf,
               size_t len, unsigned int hashSeed = 0u) {
@@ -74,6 +106,20 @@ class BloomFilter {
     }
   }
 
+  /** A bloom filter sized to a power of two bits (see BLOOM_SIZING_POW2),
+   * which can be shrunk with fold(). */
+  static BloomFilter power_of_two(size_t items, double error,
+                                  unsigned int hashSeed = 0u,
+                                  bloom_alloc alloc = BLOOM_ALLOC_HEAP) {
+    BloomFilter bf;
+    if (bloom_init_alloc(&bf.m_bf, items, error, BLOOM_SIZING_POW2, alloc) !=
+        0) {
+      throw std::runtime_error("Failed to initialize the bloom");
+    }
+    bf.set_hash_seed(hashSeed);
+    return bf;
+  }
+
   /** Copy constructor */
   BloomFilter(const BloomFilter &other) {
     m_bf.ready = 0;
@@ -83,21 +129,33 @@ class BloomFilter {
   /** copy assignment */
   inline BloomFilter &operator=(const BloomFilter &other) {
     if (this != &other) {
-      size_t old_bits = (m_bf.ready == 0) ? 0 : m_bf.bits;
+      if (m_bf.ready && m_bf.alloc != BLOOM_ALLOC_HEAP) {
+        // the copy goes on the heap, so drop the mapping (but not the stats)
+        struct bloom_stats *stats = m_bf.stats;
+        m_bf.stats = nullptr;
+        bloom_free(&m_bf);
+        m_bf.stats = stats;
+      }
+      size_t old_bytes = (m_bf.ready == 0) ? 0 : m_bf.bytes;
       m_bf.entries = other.m_bf.entries;
       m_bf.error = other.m_bf.error;
       m_bf.bits = other.m_bf.bits;
       m_bf.bytes = other.m_bf.bytes;
       m_bf.hashes = other.m_bf.hashes;
       m_bf.bpe = other.m_bf.bpe;
-      if (old_bits != m_bf.bits) {
-        m_bf.bf = (unsigned char *) realloc(m_bf.bf, m_bf.bits);
-        if (m_bf.bf == nullptr) {
+      if (old_bytes != m_bf.bytes) {
+        unsigned char *bf = (unsigned char *) realloc(
+            m_bf.ready ? m_bf.bf : nullptr, m_bf.bytes);
+        if (bf == nullptr) {
           throw std::runtime_error("Reallocating space failed.");
         }
+        m_bf.bf = bf;
       }
       std::copy(other.m_bf.bf, other.m_bf.bf + m_bf.bytes, m_bf.bf);
       m_bf.hashSeed = other.m_bf.hashSeed;
+      m_bf.hash_id = other.m_bf.hash_id;
+      m_bf.hash_fn = other.m_bf.hash_fn;
+      m_bf.mask = other.m_bf.mask;
       m_bf.ready = other.m_bf.ready;
 #ifdef COUNTING_SET_BITS_ON
       m_bf.num_set_bits = other.m_bf.num_set_bits;
@@ -106,6 +164,13 @@ class BloomFilter {
     return *this;
   }
 
+  /** Move constructor */
+  BloomFilter(BloomFilter &&other) noexcept : m_bf(other.m_bf) {
+    other.m_bf.bf = nullptr;
+    other.m_bf.stats = nullptr;
+    other.m_bf.ready = 0;
+  }
+
   /* deconstructor */
   ~BloomFilter() { bloom_free(&m_bf); }
 
@@ -116,9 +181,17 @@ class BloomFilter {
   /** Return the number of hash functions. */
   inline size_t num_hashes() const { return m_bf.hashes; }
 
+  /** Return the desired false positive rate. */
+  inline double error() const { return m_bf.error; }
+
   /** Return the hash seed (for reproducibility) */
   inline unsigned hash_seed() const { return m_bf.hashSeed; }
 
+  /** Return the hash function this bloom filter was built with. */
+  inline bloom_hash hash() const { return (bloom_hash) m_bf.hash_id; }
+
+  inline const char *hash_name() const { return bloom_hash_name(m_bf.hash_id); }
+
   /** Return the raw constant of bloom filter. */
   const unsigned char *bitmap() const { return m_bf.bf; }
 
@@ -215,6 +288,231 @@ class BloomFilter {
     return bloom_check_ns(&m_bf, (void *) &key, sizeof(key) * len);
   }
 
+  /** Hash a key once, for add_hash() and contains_hash() on any bloom
+   * filter with the same hash function and hash seed. */
+  template<typename T>
+  inline KeyHash key_hash(const T key) const {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    return key_hash((const char *) &key, sizeof(key));
+  }
+
+  inline KeyHash key_hash(const std::string &key) const {
+    return key_hash(key.c_str(), key.size());
+  }
+
+  inline KeyHash key_hash(const char *key, size_t len) const {
+    KeyHash h;
+    bloom_hash_key(&m_bf, key, len, &h);
+    return h;
+  }
+
+  /** Insert a key hashed with key_hash(). */
+  inline void add_hash(const KeyHash &h) {
+    if (bloom_add_hash(&m_bf, &h) != 0) {
+      throw std::runtime_error("Key hashed with another hash or seed");
+    }
+  }
+
+  /** Check whether a key hashed with key_hash() is contained. */
+  inline bool contains_hash(const KeyHash &h) {
+    int rv = bloom_check_hash(&m_bf, &h);
+    if (rv < 0) {
+      throw std::runtime_error("Key hashed with another hash or seed");
+    }
+    return rv;
+  }
+
+  /** Check a key hashed with key_hash() against every bloom filter of
+   * `filters` (which must share its hash function and hash seed), see
+   * bloom_check_hash_many(). found[i] is set for the filters containing the
+   * key; returns their number. */
+  static size_t contains_hash_many(const KeyHash &h,
+                                   const std::vector<BloomFilter *> &filters,
+                                   std::vector<bool> &found) {
+    std::vector<struct bloom *> blooms(filters.size());
+    std::vector<int> results(filters.size());
+    for (size_t i = 0; i < filters.size(); ++i) blooms[i] = &filters[i]->m_bf;
+    size_t n = bloom_check_hash_many(blooms.data(), blooms.size(), &h,
+                                     results.data());
+    found.assign(filters.size(), false);
+    for (size_t i = 0; i < filters.size(); ++i) {
+      if (results[i] < 0) {
+        throw std::runtime_error("Key hashed with another hash or seed");
+      }
+      found[i] = results[i] == 1;
+    }
+    return n;
+  }
+
+  /** Insert every k-mer of the DNA sequence `seq` (`len` bases), hashed
+   * with the rolling ntHash (see NtHash.h) rather than the hash function of
+   * this bloom filter, so that a k-mer and its reverse complement are the
+   * same key: look them up with count_kmer_hits() or contains_kmer(), not
+   * contains(). K-mers with a base other than A, C, G or T are skipped.
+   * Returns the number of k-mers inserted. */
+  inline size_t add_kmers(const char *seq, size_t len, unsigned k) {
+    return for_each_kmer(seq, len, k, [this](const KeyHash &h) {
+      bloom_add_hash(&m_bf, &h);
+      return true;
+    });
+  }
+
+  inline size_t add_kmers(const std::string &seq, unsigned k) {
+    return add_kmers(seq.c_str(), seq.size(), k);
+  }
+
+  /** Return how many k-mers of `seq` are contained (see add_kmers()). */
+  inline size_t count_kmer_hits(const char *seq, size_t len, unsigned k) {
+    return for_each_kmer(seq, len, k, [this](const KeyHash &h) {
+      return bloom_check_hash(&m_bf, &h) == 1;
+    });
+  }
+
+  inline size_t count_kmer_hits(const std::string &seq, unsigned k) {
+    return count_kmer_hits(seq.c_str(), seq.size(), k);
+  }
+
+  /** Check whether the k-mer `kmer` (k bases) or its reverse complement was
+   * inserted with add_kmers(). */
+  inline bool contains_kmer(const char *kmer, unsigned k) {
+    return count_kmer_hits(kmer, k, k) == 1;
+  }
+
+  /** Insert a key; safe to call from several threads at the same time (see
+   * bloom_add_atomic()). */
+  template<typename T>
+  inline void add_atomic(const T key) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    bloom_add_atomic(&m_bf, (void *) &key, sizeof(key));
+  }
+
+  inline void add_atomic(const char *key, size_t len) {
+    bloom_add_atomic(&m_bf, (void *) key, len);
+  }
+
+  inline void add_atomic(const std::string &key) {
+    add_atomic(key.c_str(), key.size());
+  }
+
+  /** Insert `n` keys stored contiguously at `keys`, setting the bits of
+   * large batches region by region (see bloom_add_many()). */
+  template<typename T>
+  inline void add_many(const T *keys, size_t n) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    BLOOM_PROBE2(add_many__start, &m_bf, n);
+    bloom_add_many(&m_bf, keys, sizeof(T), n);
+    BLOOM_PROBE2(add_many__done, &m_bf, n);
+  }
+
+  /** add_many() which, like add_atomic(), several threads may call at the
+   * same time to build one bloom filter in parallel. */
+  template<typename T>
+  inline void add_many_atomic(const T *keys, size_t n) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    BLOOM_PROBE2(add_many__start, &m_bf, n);
+    bloom_add_many_atomic(&m_bf, keys, sizeof(T), n);
+    BLOOM_PROBE2(add_many__done, &m_bf, n);
+  }
+
+  /** Union `other` into this bloom filter. Both filters must have been
+   * created with the same items, error, hash function and hash seed. */
+  inline void merge(const BloomFilter &other) {
+    if (other.size() != size() || other.num_hashes() != num_hashes() ||
+        other.hash_seed() != hash_seed() || other.hash() != hash()) {
+      throw std::runtime_error("Bloom filter shapes mismatch!");
+    }
+    BLOOM_PROBE2(merge, &m_bf, &other.m_bf);
+    for (size_t i = 0; i < m_bf.bytes; ++i) {
+      m_bf.bf[i] |= other.m_bf.bf[i];
+    }
+  }
+
+  /** Serialize this bloom filter (parameters and bitmap) into a byte array
+   * that can be shipped to another host, see bloom_serialize(). */
+  inline std::vector<unsigned char> serialize() const {
+    std::vector<unsigned char> out(serialized_size());
+    serialize(out.data(), out.size());
+    return out;
+  }
+
+  /** Serialize into a caller-supplied buffer of serialized_size() bytes. */
+  inline void serialize(unsigned char *out, size_t len) const {
+    if (bloom_serialize(&m_bf, out, len) != 0) {
+      throw std::runtime_error("Failed to serialize the bloom");
+    }
+  }
+
+  /** Serialize this bloom filter compressed with `codec` (enum
+   * bloom_codec, chosen from the fill ratio by default), see
+   * bloom_serialize_compressed(). deserialize() reads either form. */
+  inline std::vector<unsigned char> serialize_compressed(
+      int codec = BLOOM_CODEC_AUTO) const {
+    std::vector<unsigned char> out(bloom_compressed_bound(&m_bf));
+    size_t len;
+    if (bloom_serialize_compressed(&m_bf, codec, out.data(), out.size(),
+                                   &len) != 0) {
+      throw std::runtime_error("Failed to serialize the bloom");
+    }
+    out.resize(len);
+    return out;
+  }
+
+  /** Return the size of the output of serialize(). */
+  inline size_t serialized_size() const {
+    return bloom_serialized_size(&m_bf);
+  }
+
+  /** Re-construct a bloom filter from the output of serialize(). */
+  static BloomFilter deserialize(const unsigned char *data, size_t len) {
+    BloomFilter bf;
+    if (bloom_deserialize(&bf.m_bf, data, len) != 0) {
+      throw std::runtime_error("Failed to deserialize the bloom");
+    }
+    return bf;
+  }
+
+  /** Return a checksum of the bitmap, see bloom_checksum(). */
+  inline uint64_t checksum() const { return bloom_checksum(&m_bf); }
+
+  /** Return the delta which turns `older`, a previous version of this bloom
+   * filter, into this one; see bloom_diff(). */
+  inline std::vector<unsigned char> diff(const BloomFilter &older) const {
+    std::vector<unsigned char> out(bloom_delta_bound(&m_bf));
+    size_t len;
+    if (bloom_diff(&m_bf, &older.m_bf, out.data(), out.size(), &len) != 0) {
+      throw std::runtime_error("Bloom filter shapes mismatch!");
+    }
+    out.resize(len);
+    return out;
+  }
+
+  /** Apply a delta from diff(). Throws, leaving this bloom filter as it
+   * was, unless this bloom filter is the version the delta was made from. */
+  inline void apply_delta(const unsigned char *delta, size_t len) {
+    if (bloom_apply_delta(&m_bf, delta, len) != 0) {
+      throw std::runtime_error("Delta does not apply to this bloom");
+    }
+  }
+
+  inline void apply_delta(const std::vector<unsigned char> &delta) {
+    apply_delta(delta.data(), delta.size());
+  }
+
+  /** Shrink this bloom filter by `factor` (a power of two), keeping its
+   * members; see bloom_fold(). Only for filters made by power_of_two(). */
+  inline void fold(unsigned int factor) {
+    if (bloom_fold(&m_bf, factor) != 0) {
+      throw std::runtime_error("Failed to fold the bloom");
+    }
+  }
+
+  /** Return the estimated false positive rate after fold(factor). */
+  inline double fold_fpp(unsigned int factor) const {
+    double fpp = bloom_fold_fpr(&m_bf, factor);
+    if (fpp < 0) throw std::runtime_error("Failed to fold the bloom");
+    return fpp;
+  }
+
   /** Reset this bloom filter. */
   inline void reset() { bloom_reset(&m_bf); }
 
@@ -231,10 +529,95 @@ class BloomFilter {
   /** Print this bloom filter. */
   inline void print() { bloom_print(&m_bf); }
 
+  /** Start collecting runtime statistics (adds, lookups, positives and
+   * probe depths), see bloom_stats_enable(). Copies of this bloom filter do
+   * not inherit them. */
+  inline void enable_stats() {
+    if (bloom_stats_enable(&m_bf) != 0) {
+      throw std::runtime_error("Failed to enable statistics");
+    }
+  }
+
+  /** Stop collecting runtime statistics and drop them. */
+  inline void disable_stats() { bloom_stats_disable(&m_bf); }
+
+  inline bool stats_enabled() const { return m_bf.stats != nullptr; }
+
+  /** Return the current statistics, see bloom_stats_get(). */
+  inline bloom_stats_snapshot snapshot() const {
+    bloom_stats_snapshot snap;
+    if (bloom_stats_get(&m_bf, &snap) != 0) {
+      throw std::runtime_error("Statistics are not enabled");
+    }
+    return snap;
+  }
+
+  /** Return the statistics in the Prometheus text exposition format,
+   * labelled with filter="`name`". */
+  inline std::string stats_prometheus(const std::string &name) const {
+    size_t len = bloom_stats_format(&m_bf, name.c_str(), nullptr, 0);
+    if (len == 0) {
+      throw std::runtime_error("Statistics are not enabled");
+    }
+    std::string text(len, '\0');
+    // +1 for the terminating NUL; the text may have grown in between
+    len = bloom_stats_format(&m_bf, name.c_str(), &text[0], len + 1);
+    text.resize(std::min(len, text.size()));
+    return text;
+  }
+
+  /** Atomically replace the file at `path` with stats_prometheus(name), for
+   * a scraper to pick up. */
+  inline void export_stats(const std::string &name,
+                           const std::string &path) const {
+    if (bloom_stats_export(&m_bf, name.c_str(), path.c_str()) != 0) {
+      throw std::runtime_error("Failed to export statistics");
+    }
+  }
+
  private:
+  BloomFilter() = default;
+
   inline void set_hash_seed(unsigned seed) {
     if (seed > 0) m_bf.hashSeed = seed;
   }
+
+  // k-mers hashed ahead of the bits they probe
+  static const size_t KMER_BATCH = 16;
+
+  /** Call f(hash) for every k-mer of `seq` and return the number of calls
+   * returning true. K-mers are hashed KMER_BATCH at a time and the bits
+   * each probes are prefetched before any is visited, so that their cache
+   * misses overlap. The second hash of the double hashing is derived
+   * from the canonical ntHash as ntHash does for its extra hashes. */
+  template<typename F>
+  size_t for_each_kmer(const char *seq, size_t len, unsigned k, F f) {
+    const uint64_t multiplier = 1u ^ (uint64_t) k * 0x90b45d39fb6da1faull;
+    const uint64_t seed = (uint64_t) m_bf.hashSeed * 0x9e3779b97f4a7c15ull;
+    NtHash kmers(seq, len, k);
+    KeyHash batch[KMER_BATCH];
+    size_t count = 0;
+    bool more = true;
+    while (more) {
+      size_t n = 0;
+      while (n < KMER_BATCH && (more = kmers.next())) {
+        KeyHash &h = batch[n++];
+        h.a = kmers.hash() ^ seed;
+        h.b = kmers.hash() * multiplier;
+        h.b ^= h.b >> 27u;
+        h.seed = m_bf.hashSeed;
+        h.hash_id = m_bf.hash_id;
+        for (unsigned i = 0; i < (unsigned) m_bf.hashes; ++i) {
+          size_t y = (size_t) h.a + i * (size_t) h.b;
+          size_t x = m_bf.mask ? y & m_bf.mask : y % m_bf.bits;
+          __builtin_prefetch(m_bf.bf + (x >> 3u));
+        }
+      }
+      for (size_t i = 0; i < n; ++i) count += f(batch[i]);
+    }
+    return count;
+  }
+
   struct bloom m_bf{};
 };
 
@@ -0,0 +1,228 @@
+/**
+ * A pool of many small bloom filters of one shape (items, error, hash
+ * function and hash seed) in one 64-byte aligned slab.
+ *
+ * A filter is a slot of the slab addressed by an integer id; the shape is
+ * stored once for the whole pool, so a filter costs its bitmap (rounded up
+ * to 8 bytes) and nothing else. A slot's bitmap is the same as that of a
+ * BloomFilter of the same shape holding the same keys. Slots are handed out
+ * by allocate() and recycled by release(); the slab doubles when it is full.
+ */
+
+#ifndef BLOOM_FILTER_POOL_H_
+#define BLOOM_FILTER_POOL_H_
+
+#include "BloomFilter.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+class BloomFilterPool {
+ public:
+  /** constructor: a pool of filters for `items` items at false positive
+   * rate `error`, with room for `capacity` filters before the slab grows. */
+  BloomFilterPool(size_t items, double error, size_t capacity = 1024,
+                  unsigned int hashSeed = 0u) {
+    if (!(items > 0 && error > 0 && error < 1.0)) {
+      throw std::runtime_error("Failed to initialize the bloom");
+    }
+    bloom_init_wo_allocation(&m_shape, items, error);
+    if (hashSeed > 0) m_shape.hashSeed = hashSeed;
+    m_stride = (m_shape.bytes + 7) / 8 * 8;
+    grow(std::max<size_t>(capacity, 1));
+  }
+
+  /** constructor: hashing with `hash` instead of the default hash. */
+  BloomFilterPool(size_t items, double error, size_t capacity, bloom_hash hash,
+                  unsigned int hashSeed = 0u)
+      : BloomFilterPool(items, error, capacity, hashSeed) {
+    if (bloom_set_hash(&m_shape, hash) != 0) {
+      throw std::runtime_error("Hash function not available");
+    }
+  }
+
+  BloomFilterPool(const BloomFilterPool &) = delete;
+  BloomFilterPool &operator=(const BloomFilterPool &) = delete;
+
+  ~BloomFilterPool() { free(m_slab); }
+
+  /** Return the id of an empty filter. */
+  size_t allocate() {
+    size_t id;
+    if (!m_free.empty()) {
+      id = m_free.back();
+      m_free.pop_back();
+      reset(id);
+    } else {
+      if (m_used == m_capacity) grow(2 * m_capacity);
+      id = m_used++;
+    }
+    m_live[id] = true;
+    return id;
+  }
+
+  /** Give filter `id` back to the pool; a later allocate() reuses it. */
+  void release(size_t id) {
+    check(id);
+    m_live[id] = false;
+    m_free.push_back(id);
+  }
+
+  /** Reset filter `id` (all bits to zero). */
+  inline void reset(size_t id) { std::memset(slot(id), 0, m_stride); }
+
+  template<typename T>
+  inline void add(size_t id, const T key) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    add_hash(id, key_hash((const char *) &key, sizeof(key)));
+  }
+
+  inline void add(size_t id, const std::string &key) {
+    add_hash(id, key_hash(key.c_str(), key.size()));
+  }
+
+  inline void add(size_t id, const char *key, size_t len) {
+    add_hash(id, key_hash(key, len));
+  }
+
+  /** Insert a key hashed with key_hash() (or BloomFilter::key_hash() of a
+   * filter of the same hash function and seed) into filter `id`. */
+  inline void add_hash(size_t id, const KeyHash &h) {
+    check(id);
+    check(h);
+    unsigned char *bf = slot(id);
+    for (size_t i = 0; i < (size_t) m_shape.hashes; ++i) {
+      size_t x = ((size_t) h.a + i * (size_t) h.b) % m_shape.bits;
+      bf[x >> 3u] |= (unsigned char) (1u << (x & 7u));
+    }
+  }
+
+  /** Check whether filter `id` contains a key. */
+  template<typename T>
+  inline bool contains(size_t id, const T key) const {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    return contains_hash(id, key_hash((const char *) &key, sizeof(key)));
+  }
+
+  inline bool contains(size_t id, const std::string &key) const {
+    return contains_hash(id, key_hash(key.c_str(), key.size()));
+  }
+
+  inline bool contains(size_t id, const char *key, size_t len) const {
+    return contains_hash(id, key_hash(key, len));
+  }
+
+  inline bool contains_hash(size_t id, const KeyHash &h) const {
+    check(id);
+    return probe(slot(id), h);
+  }
+
+  /** Check `n` (ids[i], keys[i]) pairs, found[i] receiving the answer;
+   * returns the number of positives. Keys are hashed a batch at a time and
+   * the slots they probe are prefetched before any of them is checked, so
+   * the cache misses of a batch overlap. */
+  template<typename T>
+  size_t contains_many(const size_t *ids, const T *keys, size_t n,
+                       bool *found) const {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    const size_t BATCH = 16;
+    KeyHash h[BATCH];
+    size_t positives = 0;
+    for (size_t start = 0; start < n; start += BATCH) {
+      size_t end = std::min(n, start + BATCH);
+      for (size_t i = start; i < end; ++i) {
+        check(ids[i]);
+        h[i - start] = key_hash((const char *) &keys[i], sizeof(T));
+        size_t x = (size_t) h[i - start].a % m_shape.bits;
+        __builtin_prefetch(slot(ids[i]) + (x >> 3u));
+      }
+      for (size_t i = start; i < end; ++i) {
+        found[i] = probe(slot(ids[i]), h[i - start]);
+        positives += found[i];
+      }
+    }
+    return positives;
+  }
+
+  /** Hash a key once for add_hash() and contains_hash(). */
+  inline KeyHash key_hash(const char *key, size_t len) const {
+    KeyHash h;
+    bloom_hash_key(&m_shape, key, len, &h);
+    return h;
+  }
+
+  /** Return the bitmap of filter `id`, byte_size() bytes. */
+  inline const unsigned char *bitmap(size_t id) const {
+    check(id);
+    return slot(id);
+  }
+
+  /** Return the number of filters handed out and not released. */
+  inline size_t size() const { return m_used - m_free.size(); }
+
+  /** Return the number of filters the slab holds before it grows. */
+  inline size_t capacity() const { return m_capacity; }
+
+  /** Return the size of each filter's bitmap, in bits and in bytes. */
+  inline size_t bits() const { return m_shape.bits; }
+  inline size_t byte_size() const { return m_shape.bytes; }
+
+  inline size_t num_hashes() const { return m_shape.hashes; }
+  inline unsigned hash_seed() const { return m_shape.hashSeed; }
+  inline bloom_hash hash() const { return (bloom_hash) m_shape.hash_id; }
+
+ private:
+  inline unsigned char *slot(size_t id) const { return m_slab + id * m_stride; }
+
+  inline void check(size_t id) const {
+    if (id >= m_used || !m_live[id]) {
+      throw std::runtime_error("No such filter in the pool");
+    }
+  }
+
+  inline void check(const KeyHash &h) const {
+    if (h.seed != m_shape.hashSeed || h.hash_id != m_shape.hash_id) {
+      throw std::runtime_error("Key hashed with another hash or seed");
+    }
+  }
+
+  inline bool probe(const unsigned char *bf, const KeyHash &h) const {
+    check(h);
+    for (size_t i = 0; i < (size_t) m_shape.hashes; ++i) {
+      size_t x = ((size_t) h.a + i * (size_t) h.b) % m_shape.bits;
+      if (!(bf[x >> 3u] & (1u << (x & 7u)))) return false;
+    }
+    return true;
+  }
+
+  void grow(size_t capacity) {
+    unsigned char *slab = nullptr;
+    size_t bytes = std::max<size_t>(capacity * m_stride, 64);
+    if (posix_memalign((void **) &slab, 64, bytes) != 0) {
+      throw std::runtime_error("Out of memory");
+    }
+    std::memset(slab, 0, bytes);
+    if (m_slab != nullptr) {
+      std::memcpy(slab, m_slab, m_used * m_stride);
+      free(m_slab);
+    }
+    m_slab = slab;
+    m_capacity = capacity;
+    m_live.resize(capacity, false);
+  }
+
+  struct bloom m_shape{};   // parameters shared by all filters, no bitmap
+  size_t m_stride = 0;      // bytes per slot
+  unsigned char *m_slab = nullptr;
+  size_t m_capacity = 0;
+  size_t m_used = 0;        // slots handed out at least once
+  std::vector<size_t> m_free;
+  std::vector<bool> m_live;
+};
+
+#endif // BLOOM_FILTER_POOL_H_
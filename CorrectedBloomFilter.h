@@ -0,0 +1,239 @@
+/**
+ * A bloom filter with an exact set of its known false positives, for keys
+ * which must not test positive (hot legitimate keys against a blocklist,
+ * say) once a positive has been confirmed to be false.
+ *
+ * contains() tests the filter first and only consults the set on a hit, so
+ * negative lookups cost what they cost in a BloomFilter. The set holds a
+ * 64-bit fingerprint of each key, taken from the hashes the filter already
+ * computed (key_hash()), in an open-addressing table with linear probing at
+ * most half full: a hit costs one more probe, usually within one cache
+ * line. Two keys share a fingerprint with a probability of 2^-64, which is
+ * the only way a corrected key can hide a member. Adding a key drops its
+ * correction.
+ */
+
+#ifndef CORRECTED_BLOOM_FILTER_H_
+#define CORRECTED_BLOOM_FILTER_H_
+
+#include "BloomFilter.h"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+class CorrectedBloomFilter {
+ public:
+  /** constructor: a filter of `items` items at false positive rate `error`
+   * (see BloomFilter), without corrections. */
+  CorrectedBloomFilter(size_t items, double error, unsigned int hashSeed = 0u)
+      : m_filter(items, error, hashSeed) {}
+
+  /** constructor: correcting `filter`, which is moved. */
+  explicit CorrectedBloomFilter(BloomFilter &&filter)
+      : m_filter(std::move(filter)) {}
+
+  /** Insert a key. */
+  template<typename T>
+  inline void add(const T key) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    add_hash(m_filter.key_hash(key));
+  }
+
+  inline void add(const std::string &key) { add_hash(m_filter.key_hash(key)); }
+
+  inline void add(const char *key, size_t len) {
+    add_hash(m_filter.key_hash(key, len));
+  }
+
+  /** Check whether an object is contained: the filter contains it and it is
+   * not a known false positive. */
+  template<typename T>
+  inline bool contains(const T key) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    return contains_hash(m_filter.key_hash(key));
+  }
+
+  inline bool contains(const std::string &key) {
+    return contains_hash(m_filter.key_hash(key));
+  }
+
+  inline bool contains(const char *key, size_t len) {
+    return contains_hash(m_filter.key_hash(key, len));
+  }
+
+  /** Register a key confirmed not to be a member. Returns false if the
+   * filter does not contain it anyway (nothing to correct). */
+  template<typename T>
+  inline bool add_false_positive(const T key) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    return add_false_positive_hash(m_filter.key_hash(key));
+  }
+
+  inline bool add_false_positive(const std::string &key) {
+    return add_false_positive_hash(m_filter.key_hash(key));
+  }
+
+  inline bool add_false_positive(const char *key, size_t len) {
+    return add_false_positive_hash(m_filter.key_hash(key, len));
+  }
+
+  /** Return the number of registered false positives. */
+  inline size_t false_positives() const { return m_count; }
+
+  /** Return the filter. */
+  inline const BloomFilter &filter() const { return m_filter; }
+
+  /** Return the size of the bitmap and of the correction table, in bytes. */
+  inline size_t byte_size() const {
+    return m_filter.byte_size() + m_slots.size() * sizeof(uint64_t);
+  }
+
+  /** Serialize the filter (see BloomFilter::serialize()) followed by the
+   * fingerprints of the corrections, all little endian:
+   *
+   *   "BLFC" | version (4 bytes) | filter size (8) | filter | count (8) |
+   *   count fingerprints (8 each)
+   */
+  std::vector<unsigned char> serialize() const {
+    std::vector<unsigned char> filter = m_filter.serialize();
+    std::vector<unsigned char> out;
+    out.reserve(HEADER_BYTES + filter.size() + 8 * (m_count + 1));
+    put(out, MAGIC, 4);
+    put(out, VERSION, 4);
+    put(out, filter.size(), 8);
+    out.insert(out.end(), filter.begin(), filter.end());
+    put(out, m_count, 8);
+    for (uint64_t fp : m_slots) {
+      if (fp != EMPTY) put(out, fp, 8);
+    }
+    return out;
+  }
+
+  /** Re-construct from the output of serialize(). */
+  static CorrectedBloomFilter deserialize(const unsigned char *data,
+                                          size_t len) {
+    if (len < HEADER_BYTES || get(data, 4) != MAGIC ||
+        get(data + 4, 4) != VERSION) {
+      throw std::runtime_error("Invalid corrected bloom filter");
+    }
+    uint64_t filter_len = get(data + 8, 8);
+    if (filter_len > len - HEADER_BYTES ||
+        len - HEADER_BYTES - filter_len < 8) {
+      throw std::runtime_error("Invalid corrected bloom filter");
+    }
+    const unsigned char *p = data + HEADER_BYTES;
+    CorrectedBloomFilter cbf(BloomFilter::deserialize(p, filter_len));
+    p += filter_len;
+    uint64_t count = get(p, 8), rest = len - HEADER_BYTES - filter_len - 8;
+    p += 8;
+    if (rest % 8 != 0 || count != rest / 8) {
+      throw std::runtime_error("Invalid corrected bloom filter");
+    }
+    for (uint64_t i = 0; i < count; ++i, p += 8) cbf.insert(get(p, 8));
+    return cbf;
+  }
+
+  static CorrectedBloomFilter deserialize(
+      const std::vector<unsigned char> &data) {
+    return deserialize(data.data(), data.size());
+  }
+
+ private:
+  static const uint32_t MAGIC = 0x43464c42;  // "BLFC"
+  static const uint32_t VERSION = 1;
+  static const size_t HEADER_BYTES = 16;
+  static const uint64_t EMPTY = 0;
+
+  /** The fingerprint of a key: both hashes of the double hashing, never
+   * EMPTY. */
+  static inline uint64_t fingerprint(const KeyHash &h) {
+    uint64_t fp = h.a ^ ((h.b << 32u) | (h.b >> 32u));
+    return fp == EMPTY ? 1 : fp;
+  }
+
+  inline size_t home(uint64_t fp) const {
+    return (size_t) ((fp * 0x9e3779b97f4a7c15ull) >> 32u) &
+           (m_slots.size() - 1);
+  }
+
+  /** The slot holding `fp`, or the empty slot ending its probe sequence. */
+  inline size_t find(uint64_t fp) const {
+    size_t i = home(fp);
+    while (m_slots[i] != EMPTY && m_slots[i] != fp) {
+      i = (i + 1) & (m_slots.size() - 1);
+    }
+    return i;
+  }
+
+  inline void add_hash(const KeyHash &h) {
+    m_filter.add_hash(h);
+    if (m_count > 0) erase(fingerprint(h));
+  }
+
+  inline bool contains_hash(const KeyHash &h) {
+    if (!m_filter.contains_hash(h)) return false;
+    return m_count == 0 || m_slots[find(fingerprint(h))] == EMPTY;
+  }
+
+  inline bool add_false_positive_hash(const KeyHash &h) {
+    if (!m_filter.contains_hash(h)) return false;
+    insert(fingerprint(h));
+    return true;
+  }
+
+  void insert(uint64_t fp) {
+    if (2 * (m_count + 1) > m_slots.size()) {
+      std::vector<uint64_t> old(std::max<size_t>(16, 2 * m_slots.size()),
+                                uint64_t(EMPTY));
+      old.swap(m_slots);
+      for (uint64_t f : old) {
+        if (f != EMPTY) m_slots[find(f)] = f;
+      }
+    }
+    size_t i = find(fp);
+    if (m_slots[i] == EMPTY) {
+      m_slots[i] = fp;
+      m_count++;
+    }
+  }
+
+  /** Remove `fp`, shifting back the entries probed past it. */
+  void erase(uint64_t fp) {
+    const size_t mask = m_slots.size() - 1;
+    size_t i = find(fp);
+    if (m_slots[i] == EMPTY) return;
+    for (size_t j = (i + 1) & mask; m_slots[j] != EMPTY; j = (j + 1) & mask) {
+      // move the entry at j into the hole at i unless its home lies
+      // cyclically in (i, j]
+      if (((j - home(m_slots[j])) & mask) >= ((j - i) & mask)) {
+        m_slots[i] = m_slots[j];
+        i = j;
+      }
+    }
+    m_slots[i] = EMPTY;
+    m_count--;
+  }
+
+  static void put(std::vector<unsigned char> &out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+      out.push_back((unsigned char) (v >> (8 * i)));
+    }
+  }
+
+  static uint64_t get(const unsigned char *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) v |= (uint64_t) p[i] << (8 * i);
+    return v;
+  }
+
+  BloomFilter m_filter;
+  std::vector<uint64_t> m_slots;  // a power of two slots, or none
+  size_t m_count = 0;
+};
+
+#endif // CORRECTED_BLOOM_FILTER_H_
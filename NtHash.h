@@ -0,0 +1,124 @@
+/**
+ * ntHash, a rolling hash of the k-mers of a DNA sequence (Mohamadi et al.,
+ * "ntHash: recursive nucleotide hashing", Bioinformatics 2016).
+ *
+ * The hash of a k-mer is the XOR of a 64-bit seed per base, each rotated by
+ * its distance to the end of the k-mer, so the hash of the next k-mer
+ * follows from the previous one with two rotations and three XORs whatever
+ * k is. The same is done on the reverse complement, and the smaller of the
+ * two values is the canonical hash: a k-mer and its reverse complement hash
+ * the same. Bases other than A, C, G and T (either case) are not hashed;
+ * k-mers containing them are skipped.
+ */
+
+#ifndef NT_HASH_H_
+#define NT_HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+
+
+class NtHash {
+ public:
+  /** Iterate over the k-mers of `seq` (`len` bases) without an unknown
+   * base; call next() before reading the first one. */
+  NtHash(const char *seq, size_t len, unsigned k)
+      : m_seq((const unsigned char *) seq), m_len(len), m_k(k) {}
+
+  /** Move to the next k-mer; returns false past the last one. */
+  inline bool next() {
+    if (m_valid) {
+      if (m_pos + m_k >= m_len) return false;
+      const unsigned char out = m_seq[m_pos], in = m_seq[m_pos + m_k];
+      if (seed(in) != 0) {
+        m_forward = rol(m_forward, 1) ^ rol(seed(out), m_k) ^ seed(in);
+        m_reverse = ror(m_reverse, 1) ^ ror(seed(complement(out)), 1) ^
+                    rol(seed(complement(in)), m_k - 1);
+        m_pos++;
+        return true;
+      }
+      m_pos += m_k + 1;
+      m_valid = false;
+    }
+    return restart();
+  }
+
+  /** Return the canonical hash of the current k-mer. */
+  inline uint64_t hash() const {
+    return m_forward < m_reverse ? m_forward : m_reverse;
+  }
+
+  /** Return the offset of the current k-mer in the sequence. */
+  inline size_t pos() const { return m_pos; }
+
+  /** Return the canonical hash of the k-mer `kmer`, or 0 if it has an
+   * unknown base. */
+  static uint64_t kmer(const char *kmer, unsigned k) {
+    NtHash h(kmer, k, k);
+    return h.next() ? h.hash() : 0;
+  }
+
+ private:
+  static inline uint64_t rol(uint64_t x, unsigned n) {
+    n &= 63u;
+    return n == 0 ? x : (x << n) | (x >> (64u - n));
+  }
+
+  static inline uint64_t ror(uint64_t x, unsigned n) {
+    n &= 63u;
+    return n == 0 ? x : (x >> n) | (x << (64u - n));
+  }
+
+  /** The seed of a base, 0 for an unknown one. */
+  static inline uint64_t seed(unsigned char base) {
+    switch (base) {
+      case 'A': case 'a': return 0x3c8bfbb395c60474ull;
+      case 'C': case 'c': return 0x3193c18562a02b4cull;
+      case 'G': case 'g': return 0x20323ed082572324ull;
+      case 'T': case 't': return 0x295549f54be24456ull;
+      default: return 0;
+    }
+  }
+
+  static inline unsigned char complement(unsigned char base) {
+    switch (base) {
+      case 'A': case 'a': return 'T';
+      case 'C': case 'c': return 'G';
+      case 'G': case 'g': return 'C';
+      default: return 'A';
+    }
+  }
+
+  /** Hash the first k-mer at or after m_pos without an unknown base. */
+  bool restart() {
+    if (m_k == 0) return false;
+    size_t run = 0;
+    for (size_t i = m_pos; i < m_len; ++i) {
+      if (seed(m_seq[i]) == 0) {
+        run = 0;
+        m_pos = i + 1;
+        continue;
+      }
+      if (++run < m_k) continue;
+      m_forward = m_reverse = 0;
+      for (unsigned j = 0; j < m_k; ++j) {
+        const unsigned char base = m_seq[m_pos + j];
+        m_forward ^= rol(seed(base), m_k - 1 - j);
+        m_reverse ^= rol(seed(complement(base)), j);
+      }
+      m_valid = true;
+      return true;
+    }
+    m_pos = m_len;
+    return false;
+  }
+
+  const unsigned char *m_seq;
+  size_t m_len;
+  unsigned m_k;
+  size_t m_pos = 0;
+  bool m_valid = false;
+  uint64_t m_forward = 0, m_reverse = 0;
+};
+
+#endif // NT_HASH_H_
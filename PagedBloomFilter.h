@@ -0,0 +1,469 @@
+/**
+ * A bloom filter kept in a file, for sets whose filter is larger than RAM.
+ *
+ * The bitmap is split into 4 KiB pages and every key maps to one page: the
+ * first hash of the key picks the page and the second one the k bits within
+ * it (a blocked bloom filter with page-sized blocks), so an add or a lookup
+ * costs at most one page read. A fixed number of pages is cached in memory
+ * (CLOCK replacement); dirty pages are written back when they are evicted
+ * and on flush(). add_many() and contains_many() gather the pages a batch of
+ * keys needs and read the missing ones in parallel with a small pool of
+ * threads doing pread(), so the latency of the device overlaps.
+ *
+ * The file holds a one-page header and the pages; create() makes a sparse
+ * file, open() reopens one. Not thread-safe: like BloomFilter, use one
+ * object from one thread at a time.
+ */
+
+#ifndef PAGED_BLOOM_FILTER_H_
+#define PAGED_BLOOM_FILTER_H_
+
+#include "BloomFilter.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+class PagedBloomFilter {
+ public:
+  static const size_t PAGE_SIZE = 4096;
+  static const size_t PAGE_BITS = PAGE_SIZE * 8;
+
+  /** Create (or truncate) the file `path` for a filter of `items` items at
+   * false positive rate `error`, caching `cache_pages` pages in memory and
+   * reading with `io_threads` threads. */
+  static PagedBloomFilter create(const std::string &path, size_t items,
+                                 double error, size_t cache_pages = 1024,
+                                 unsigned int hashSeed = 0u,
+                                 size_t io_threads = 4) {
+    if (!(items > 0 && error > 0 && error < 1.0)) {
+      throw std::runtime_error("Failed to initialize the bloom");
+    }
+    struct bloom shape{};
+    bloom_init_wo_allocation(&shape, items, error);
+    if (hashSeed > 0) shape.hashSeed = hashSeed;
+    Header h{MAGIC, VERSION, (uint16_t) shape.hash_id, (uint32_t) shape.hashes,
+             shape.hashSeed, (shape.bits + PAGE_BITS - 1) / PAGE_BITS,
+             (uint64_t) items, error};
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("Failed to create " + path);
+    unsigned char page[PAGE_SIZE] = {};
+    std::memcpy(page, &h, sizeof(h));
+    if (pwrite(fd, page, PAGE_SIZE, 0) != (ssize_t) PAGE_SIZE ||
+        ftruncate(fd, (off_t) ((h.pages + 1) * PAGE_SIZE)) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Failed to write " + path);
+    }
+    return PagedBloomFilter(fd, h, cache_pages, io_threads);
+  }
+
+  /** Open a filter made by create(). */
+  static PagedBloomFilter open(const std::string &path,
+                               size_t cache_pages = 1024,
+                               size_t io_threads = 4) {
+    int fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0) throw std::runtime_error("Failed to open " + path);
+    Header h;
+    struct stat st;
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h) ||
+        fstat(fd, &st) != 0 || h.magic != MAGIC || h.version != VERSION ||
+        bloom_hash_function(h.hash_id) == nullptr || h.pages == 0 ||
+        (uint64_t) st.st_size != (h.pages + 1) * PAGE_SIZE) {
+      ::close(fd);
+      throw std::runtime_error("Invalid paged bloom filter " + path);
+    }
+    return PagedBloomFilter(fd, h, cache_pages, io_threads);
+  }
+
+  PagedBloomFilter(PagedBloomFilter &&other) noexcept
+      : m_fd(other.m_fd), m_header(other.m_header),
+        m_shape(other.m_shape), m_cache(std::move(other.m_cache)),
+        m_frames(std::move(other.m_frames)), m_slots(std::move(other.m_slots)),
+        m_hand(other.m_hand), m_batch(other.m_batch),
+        m_pool(std::move(other.m_pool)), m_hits(other.m_hits),
+        m_reads(other.m_reads), m_writes(other.m_writes) {
+    other.m_fd = -1;
+  }
+
+  PagedBloomFilter(const PagedBloomFilter &) = delete;
+  PagedBloomFilter &operator=(const PagedBloomFilter &) = delete;
+  PagedBloomFilter &operator=(PagedBloomFilter &&) = delete;
+
+  /** Writes back the dirty pages; call flush() first to see errors. */
+  ~PagedBloomFilter() {
+    if (m_fd < 0) return;
+    try {
+      flush();
+    } catch (const std::runtime_error &) {
+    }
+    m_pool.reset();
+    ::close(m_fd);
+  }
+
+  template<typename T>
+  inline void add(const T key) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    add_hash(hash((const char *) &key, sizeof(key)));
+  }
+
+  inline void add(const std::string &key) {
+    add_hash(hash(key.c_str(), key.size()));
+  }
+
+  inline void add(const char *key, size_t len) { add_hash(hash(key, len)); }
+
+  template<typename T>
+  inline bool contains(const T key) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    return contains_hash(hash((const char *) &key, sizeof(key)));
+  }
+
+  inline bool contains(const std::string &key) {
+    return contains_hash(hash(key.c_str(), key.size()));
+  }
+
+  inline bool contains(const char *key, size_t len) {
+    return contains_hash(hash(key, len));
+  }
+
+  /** Insert `n` keys, reading the pages they need a batch at a time. */
+  template<typename T>
+  void add_many(const T *keys, size_t n) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    batched(keys, n, [this](const KeyHash &h, Frame &f, size_t) {
+      set_bits(f.data, h);
+      f.dirty = true;
+    });
+  }
+
+  /** Check `n` keys, found[i] receiving the answer for keys[i]; returns the
+   * number of positives. */
+  template<typename T>
+  size_t contains_many(const T *keys, size_t n, bool *found) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    size_t positives = 0;
+    batched(keys, n,
+            [this, found, &positives](const KeyHash &h, Frame &f, size_t i) {
+              found[i] = test_bits(f.data, h);
+              positives += found[i];
+            });
+    return positives;
+  }
+
+  /** Write the dirty pages back to the file. */
+  void flush() {
+    for (Frame &f : m_frames) {
+      if (f.dirty) write_back(f);
+    }
+    if (fdatasync(m_fd) != 0) throw std::runtime_error("Failed to sync");
+  }
+
+  /** Return the number of 4 KiB pages of the bitmap. */
+  inline size_t pages() const { return m_header.pages; }
+
+  /** Return the size of the bitmap, in bits. */
+  inline size_t size() const { return m_header.pages * PAGE_BITS; }
+
+  inline size_t num_hashes() const { return m_header.hashes; }
+  inline unsigned hash_seed() const { return m_header.seed; }
+  inline bloom_hash hash() const { return (bloom_hash) m_header.hash_id; }
+
+  /** Return the number of pages cached in memory. */
+  inline size_t cache_pages() const { return m_frames.size(); }
+
+  /** Return the page accesses served from the cache, the pages read from
+   * and the pages written to the file so far. */
+  inline size_t cache_hits() const { return m_hits; }
+  inline size_t page_reads() const { return m_reads; }
+  inline size_t page_writes() const { return m_writes; }
+
+ private:
+  static const uint32_t MAGIC = 0x504d4c42;  // "BLMP"
+  static const uint16_t VERSION = 1;
+
+  struct Header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t hash_id;
+    uint32_t hashes;
+    uint32_t seed;
+    uint64_t pages;
+    uint64_t entries;
+    double error;
+  };
+
+  struct Frame {
+    size_t page = SIZE_MAX;  // page held, SIZE_MAX if none
+    unsigned char *data = nullptr;
+    bool dirty = false;
+    bool referenced = false;
+    size_t batch = 0;        // pinned while this batch is served
+  };
+
+  /** Threads doing pread() of the pages of a batch. */
+  class ReadPool {
+   public:
+    ReadPool(int fd, size_t threads) : m_fd(fd) {
+      for (size_t i = 0; i < threads; ++i) {
+        m_threads.emplace_back([this]() { run(); });
+      }
+    }
+
+    ~ReadPool() {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_wake.notify_all();
+      for (std::thread &t : m_threads) t.join();
+    }
+
+    /** Read every (page, frame) pair; returns false if any read failed. */
+    bool read(const std::vector<std::pair<size_t, unsigned char *>> &jobs) {
+      if (m_threads.empty() || jobs.size() == 1) {
+        bool ok = true;
+        for (const auto &job : jobs) ok &= read_page(job.first, job.second);
+        return ok;
+      }
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_jobs = &jobs;
+      m_next = 0;
+      m_pending = jobs.size();
+      m_ok = true;
+      m_round++;
+      m_wake.notify_all();
+      m_done.wait(lock, [this]() { return m_pending == 0; });
+      m_jobs = nullptr;
+      return m_ok;
+    }
+
+   private:
+    bool read_page(size_t page, unsigned char *data) const {
+      return pread(m_fd, data, PAGE_SIZE, (off_t) ((page + 1) * PAGE_SIZE)) ==
+             (ssize_t) PAGE_SIZE;
+    }
+
+    void run() {
+      size_t round = 0;
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (true) {
+        m_wake.wait(lock, [&]() { return m_stop || m_round != round; });
+        if (m_stop) return;
+        round = m_round;
+        const auto *jobs = m_jobs;  // null if the round is over already
+        while (jobs != nullptr && m_next < jobs->size()) {
+          const auto &job = (*jobs)[m_next++];
+          lock.unlock();
+          bool ok = read_page(job.first, job.second);
+          lock.lock();
+          m_ok = m_ok && ok;
+          if (--m_pending == 0) m_done.notify_one();
+        }
+      }
+    }
+
+    int m_fd;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_done;
+    const std::vector<std::pair<size_t, unsigned char *>> *m_jobs = nullptr;
+    size_t m_next = 0, m_pending = 0, m_round = 0;
+    bool m_ok = true, m_stop = false;
+  };
+
+  PagedBloomFilter(int fd, const Header &h, size_t cache_pages,
+                   size_t io_threads)
+      : m_fd(fd), m_header(h) {
+    m_shape.hashSeed = h.seed;
+    m_shape.hashes = (int) h.hashes;
+    if (bloom_set_hash(&m_shape, h.hash_id) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Hash function not available");
+    }
+#ifdef POSIX_FADV_RANDOM
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+    cache_pages = std::max<size_t>(cache_pages, 2);
+    unsigned char *cache = nullptr;
+    if (posix_memalign((void **) &cache, PAGE_SIZE,
+                       cache_pages * PAGE_SIZE) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Out of memory");
+    }
+    m_cache.reset(cache);
+    m_frames.resize(cache_pages);
+    for (size_t i = 0; i < cache_pages; ++i) {
+      m_frames[i].data = cache + i * PAGE_SIZE;
+    }
+    m_pool.reset(new ReadPool(fd, io_threads));
+  }
+
+  inline KeyHash hash(const char *key, size_t len) const {
+    KeyHash h;
+    bloom_hash_key(&m_shape, key, len, &h);
+    return h;
+  }
+
+  inline size_t page_of(const KeyHash &h) const {
+    return (size_t) (h.a % m_header.pages);
+  }
+
+  // The k bits of a key within its page: (b + i * step) mod PAGE_BITS, with
+  // an odd step so that they are distinct.
+  inline void set_bits(unsigned char *page, const KeyHash &h) const {
+    const size_t start = (size_t) h.b, step = (size_t) (h.b >> 15u) | 1u;
+    for (size_t i = 0; i < m_header.hashes; ++i) {
+      size_t x = (start + i * step) & (PAGE_BITS - 1);
+      page[x >> 3u] |= (unsigned char) (1u << (x & 7u));
+    }
+  }
+
+  inline bool test_bits(const unsigned char *page, const KeyHash &h) const {
+    const size_t start = (size_t) h.b, step = (size_t) (h.b >> 15u) | 1u;
+    for (size_t i = 0; i < m_header.hashes; ++i) {
+      size_t x = (start + i * step) & (PAGE_BITS - 1);
+      if (!(page[x >> 3u] & (1u << (x & 7u)))) return false;
+    }
+    return true;
+  }
+
+  inline void add_hash(const KeyHash &h) {
+    Frame &f = fetch(page_of(h));
+    set_bits(f.data, h);
+    f.dirty = true;
+  }
+
+  inline bool contains_hash(const KeyHash &h) {
+    return test_bits(fetch(page_of(h)).data, h);
+  }
+
+  /** The frame holding `page`, read in if it is not cached. */
+  Frame &fetch(size_t page) {
+    m_batch++;
+    bool cached;
+    Frame &f = frame_for(page, cached);
+    if (!cached) {
+      std::vector<std::pair<size_t, unsigned char *>> job{{page, f.data}};
+      read_into(job);
+    }
+    return f;
+  }
+
+  /** The frame of `page`; `cached` tells whether it already holds it. A new
+   * frame is taken from the CLOCK hand, skipping frames of the current
+   * batch, and written back first if dirty. */
+  Frame &frame_for(size_t page, bool &cached) {
+    auto it = m_slots.find(page);
+    if (it != m_slots.end()) {
+      Frame &f = m_frames[it->second];
+      f.referenced = true;
+      f.batch = m_batch;
+      cached = true;
+      m_hits++;
+      return f;
+    }
+    while (true) {
+      Frame &f = m_frames[m_hand];
+      size_t slot = m_hand;
+      m_hand = (m_hand + 1) % m_frames.size();
+      if (f.batch == m_batch) continue;
+      if (f.referenced) {
+        f.referenced = false;
+        continue;
+      }
+      if (f.page != SIZE_MAX) {
+        if (f.dirty) write_back(f);
+        m_slots.erase(f.page);
+      }
+      f.page = page;
+      f.referenced = true;
+      f.batch = m_batch;
+      m_slots[page] = slot;
+      cached = false;
+      return f;
+    }
+  }
+
+  void read_into(const std::vector<std::pair<size_t, unsigned char *>> &jobs) {
+    if (!m_pool->read(jobs)) {
+      for (const auto &job : jobs) forget(job.first);
+      throw std::runtime_error("Failed to read a page");
+    }
+    m_reads += jobs.size();
+  }
+
+  void forget(size_t page) {
+    auto it = m_slots.find(page);
+    if (it == m_slots.end()) return;
+    m_frames[it->second].page = SIZE_MAX;
+    m_frames[it->second].referenced = false;
+    m_slots.erase(it);
+  }
+
+  void write_back(Frame &f) {
+    if (pwrite(m_fd, f.data, PAGE_SIZE, (off_t) ((f.page + 1) * PAGE_SIZE)) !=
+        (ssize_t) PAGE_SIZE) {
+      throw std::runtime_error("Failed to write a page");
+    }
+    f.dirty = false;
+    m_writes++;
+  }
+
+  /** Call op(hash, frame, i) for every key, a batch of at most half the
+   * cache at a time: the batch's pages are pinned and the missing ones read
+   * together first. */
+  template<typename T, typename Op>
+  void batched(const T *keys, size_t n, Op op) {
+    const size_t batch = std::max<size_t>(1, m_frames.size() / 2);
+    std::vector<KeyHash> hashes;
+    std::vector<Frame *> frames;
+    std::vector<std::pair<size_t, unsigned char *>> jobs;
+    for (size_t start = 0; start < n; start += batch) {
+      size_t end = std::min(n, start + batch);
+      m_batch++;
+      hashes.clear();
+      frames.clear();
+      jobs.clear();
+      for (size_t i = start; i < end; ++i) {
+        hashes.push_back(hash((const char *) &keys[i], sizeof(T)));
+        bool cached;
+        size_t page = page_of(hashes.back());
+        frames.push_back(&frame_for(page, cached));
+        if (!cached) jobs.emplace_back(page, frames.back()->data);
+      }
+      if (!jobs.empty()) read_into(jobs);
+      for (size_t i = start; i < end; ++i) {
+        op(hashes[i - start], *frames[i - start], i);
+      }
+    }
+  }
+
+  int m_fd;
+  Header m_header;
+  struct bloom m_shape{};  // hash function and seed, no bitmap
+  std::unique_ptr<unsigned char, decltype(&free)> m_cache{nullptr, &free};
+  std::vector<Frame> m_frames;
+  std::unordered_map<size_t, size_t> m_slots;  // page -> frame
+  size_t m_hand = 0;
+  size_t m_batch = 0;
+  std::unique_ptr<ReadPool> m_pool;
+  size_t m_hits = 0, m_reads = 0, m_writes = 0;
+};
+
+#endif // PAGED_BLOOM_FILTER_H_
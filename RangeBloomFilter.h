@@ -0,0 +1,114 @@
+/**
+ * A bloom filter for integer keys which also answers range queries: "may
+ * any key in [lo, hi] have been added?".
+ *
+ * Level l is a BloomFilter of the prefixes key >> l of the added keys, for
+ * l = 0 (the keys themselves) up to levels() - 1, so every dyadic interval
+ * [p << l, ((p + 1) << l) - 1] has a filter telling whether it may hold a
+ * key. A range is covered by its largest dyadic intervals (about two per
+ * level); an interval which tests positive at level l is confirmed by
+ * probing its two halves at level l - 1, down to level 0, so that a false
+ * positive of an upper level alone does not make the range positive. Point
+ * lookups read level 0 only.
+ *
+ * Adding a key costs levels() inserts. Ranges of more than MAX_BLOCKS
+ * intervals of the top level are reported as possibly non-empty without
+ * probing.
+ */
+
+#ifndef RANGE_BLOOM_FILTER_H_
+#define RANGE_BLOOM_FILTER_H_
+
+#include "BloomFilter.h"
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+
+class RangeBloomFilter {
+ public:
+  static const size_t MAX_BLOCKS = 64;
+
+  /** constructor: for `items` keys, every level a filter of `items` items
+   * at false positive rate `error`; ranges of up to 2^(levels - 1) keys are
+   * answered from the levels directly. */
+  RangeBloomFilter(size_t items, double error, unsigned levels = 16,
+                   unsigned int hashSeed = 0u) {
+    if (levels < 1 || levels > 64) {
+      throw std::runtime_error("Failed to initialize the bloom");
+    }
+    m_levels.reserve(levels);
+    for (unsigned l = 0; l < levels; ++l) {
+      m_levels.emplace_back(items, error, hashSeed);
+    }
+  }
+
+  /** Insert a key. */
+  inline void add(uint64_t key) {
+    for (size_t l = 0; l < m_levels.size(); ++l) m_levels[l].add(key >> l);
+  }
+
+  /** Insert `n` keys stored contiguously at `keys`. */
+  template<typename T>
+  inline void add_many(const T *keys, size_t n) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    std::vector<uint64_t> prefixes(keys, keys + n);
+    for (size_t l = 0; l < m_levels.size(); ++l) {
+      if (l > 0) {
+        for (uint64_t &p : prefixes) p >>= 1u;
+      }
+      m_levels[l].add_many(prefixes.data(), n);
+    }
+  }
+
+  /** Check whether `key` may have been added. */
+  inline bool contains(uint64_t key) { return m_levels[0].contains(key); }
+
+  /** Check whether any key in [lo, hi] (inclusive) may have been added. */
+  bool may_contain_range(uint64_t lo, uint64_t hi) {
+    if (lo > hi) return false;
+    const size_t top = m_levels.size() - 1;
+    uint64_t x = lo;
+    for (size_t blocks = 0; blocks < MAX_BLOCKS;) {
+      // the largest dyadic interval which starts at x and ends by hi
+      size_t l = 0;
+      while (l < top && (x & ((2ull << l) - 1)) == 0 &&
+             hi - x >= (2ull << l) - 1) {
+        ++l;
+      }
+      if (probe(l, x >> l)) return true;
+      uint64_t end = x + ((1ull << l) - 1);
+      if (end >= hi) return false;
+      x = end + 1;
+      if (l == top) ++blocks;
+    }
+    return true;
+  }
+
+  /** Return the number of levels. */
+  inline size_t levels() const { return m_levels.size(); }
+
+  /** Return the size of the bitmaps of all levels, in bytes. */
+  inline size_t byte_size() const {
+    size_t bytes = 0;
+    for (const BloomFilter &bf : m_levels) bytes += bf.byte_size();
+    return bytes;
+  }
+
+  /** Return the filter of level `l` (prefixes key >> l). */
+  inline const BloomFilter &level(size_t l) const { return m_levels.at(l); }
+
+ private:
+  /** Whether the interval of prefix `p` at level `l` may hold a key: it
+   * does at level 0, else one of its halves must. */
+  bool probe(size_t l, uint64_t p) {
+    if (!m_levels[l].contains(p)) return false;
+    if (l == 0) return true;
+    return probe(l - 1, p << 1u) || probe(l - 1, (p << 1u) | 1u);
+  }
+
+  std::vector<BloomFilter> m_levels;
+};
+
+#endif // RANGE_BLOOM_FILTER_H_
@@ -0,0 +1,132 @@
+/**
+ * A read-only bloom filter whose shape is a compile-time constant and whose
+ * bitmap is a constant array, e.g. a header generated by bf_embed (see the
+ * bloom_embed_filter() CMake function) from a key file at build time. The
+ * bitmap then lives in .rodata: nothing is built when the process starts,
+ * and its pages are shared by every process running the binary.
+ *
+ * static_bloom_bits() and static_bloom_hashes() compute the shape of
+ * bloom_init_wo_allocation() as constant expressions, and lookups probe the
+ * same bits as BloomFilter::contains() on a filter of that shape, hash
+ * function and hash seed, so a StaticBloomFilter can be built from the
+ * bitmap of any such BloomFilter.
+ */
+
+#ifndef STATIC_BLOOM_FILTER_H_
+#define STATIC_BLOOM_FILTER_H_
+
+#include "bloom.h"
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace static_bloom_detail {
+
+// terms y^n / n (odd n) of atanh(y), smallest first
+constexpr double atanh_series(double y2, double term, int n) {
+  return n > 61 ? 0.0 : term / n + atanh_series(y2, term * y2, n + 2);
+}
+
+// natural logarithm of x * 2^e, for x > 0: the mantissa is scaled into
+// [1, 2), where ln(m) = 2 atanh((m - 1) / (m + 1)) converges quickly
+constexpr double log(double x, int e = 0) {
+  return x >= 2.0   ? log(x / 2.0, e + 1)
+         : x < 1.0  ? log(x * 2.0, e - 1)
+                    : e * 0.693147180559945309417 +
+                          2.0 * atanh_series(((x - 1) / (x + 1)) *
+                                                 ((x - 1) / (x + 1)),
+                                             (x - 1) / (x + 1), 1);
+}
+
+constexpr size_t ceil(double x) {
+  return (double) (size_t) x < x ? (size_t) x + 1 : (size_t) x;
+}
+
+// bits per entry, as in bloom_init_wo_allocation()
+constexpr double bpe(double error) {
+  return -(log(error) / 0.480453013918201);
+}
+
+}  // namespace static_bloom_detail
+
+/** Number of bits bloom_init_wo_allocation() gives a filter of `entries`
+ * items at false positive rate `error`. */
+constexpr size_t static_bloom_bits(size_t entries, double error) {
+  return static_bloom_detail::ceil((double) entries *
+                                   static_bloom_detail::bpe(error));
+}
+
+/** Number of hash functions bloom_init_wo_allocation() gives a filter at
+ * false positive rate `error`. */
+constexpr unsigned static_bloom_hashes(double error) {
+  return (unsigned) static_bloom_detail::ceil(
+      0.693147180559945 * static_bloom_detail::bpe(error));
+}
+
+template<size_t Bits, unsigned K>
+class StaticBloomFilter {
+  static_assert(Bits > 0 && K > 0, "Empty bloom filter");
+
+ public:
+  static constexpr size_t BYTES = (Bits + 7) / 8;
+
+  /** constructor: over `bitmap`, the bitmap of a BloomFilter of this shape
+   * (which is not copied), probed with hash function `hash` and seed
+   * `hashSeed` (BloomFilter::hash_seed() of that filter). */
+  constexpr StaticBloomFilter(const unsigned char (&bitmap)[BYTES],
+                              unsigned int hashSeed,
+                              bloom_hash hash = BLOOM_HASH_MURMUR2)
+      : m_bitmap(bitmap), m_seed(hashSeed), m_hash(hash) {}
+
+  /** Return the size of the "bit array". */
+  static constexpr size_t size() { return Bits; }
+
+  /** Return the number of hash functions. */
+  static constexpr size_t num_hashes() { return K; }
+
+  /** Return the size of the byte array. */
+  static constexpr size_t byte_size() { return BYTES; }
+
+  /** Return the hash seed. */
+  constexpr unsigned hash_seed() const { return m_seed; }
+
+  /** Return the hash function of this bloom filter. */
+  constexpr bloom_hash hash() const { return m_hash; }
+
+  /** Return the bitmap. */
+  constexpr const unsigned char *bitmap() const { return m_bitmap; }
+
+  /** Check whether an object is contained. */
+  template<typename T>
+  inline bool contains(const T key) const {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    return contains((const char *) &key, sizeof(key));
+  }
+
+  inline bool contains(const std::string &key) const {
+    return contains(key.c_str(), key.size());
+  }
+
+  inline bool contains(const char *key, size_t len) const {
+    bloom_hash_fn fn = bloom_hash_function(m_hash);
+    if (fn == nullptr) {
+      throw std::runtime_error("Hash function not available");
+    }
+    size_t a = (size_t) fn(key, (int) len, m_seed);
+    size_t b = (size_t) fn(key, (int) len, a);
+    for (unsigned i = 0; i < K; ++i) {
+      // Bits is a constant, so the division is a multiplication
+      size_t x = (a + i * b) % Bits;
+      if (!(m_bitmap[x >> 3u] & (1u << (x & 7u)))) return false;
+    }
+    return true;
+  }
+
+ private:
+  const unsigned char *m_bitmap;
+  unsigned int m_seed;
+  bloom_hash m_hash;
+};
+
+#endif // STATIC_BLOOM_FILTER_H_
@@ -0,0 +1,151 @@
+/**
+ * A large bloom filter behind a small summary filter of the same keys, for
+ * lookups which are mostly negative.
+ *
+ * Every negative lookup of a filter larger than the caches costs at least
+ * one miss to memory before its first zero bit. The summary is sized to
+ * stay in cache (half the L2 cache by default) and is probed first; only
+ * keys it contains go on to the large filter, so most negatives are
+ * rejected in cache. Both filters are updated by add(), and a key is hashed
+ * once for both: the summary probes a remix of the hashes of the large
+ * filter.
+ *
+ * The summary rejects a negative with probability 1 - summary_fpp(), which
+ * depends on its bits per key: it pays off while it has a few bits for
+ * every key, e.g. a 1 MiB summary for up to a million or two keys, whatever
+ * the capacity of the large filter. A positive lookup probes both filters.
+ */
+
+#ifndef TIERED_BLOOM_FILTER_H_
+#define TIERED_BLOOM_FILTER_H_
+
+#include "BloomFilter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <unistd.h>
+
+
+class TieredBloomFilter {
+ public:
+  /** constructor: a filter of `items` items at false positive rate `error`
+   * allocated as `alloc` (see BloomFilter), behind a summary of
+   * `summary_bytes` (rounded down to a power of two; half the L2 cache if
+   * 0, leaving room for the rest of the working set). */
+  TieredBloomFilter(size_t items, double error, size_t summary_bytes = 0,
+                    unsigned int hashSeed = 0u,
+                    bloom_alloc alloc = BLOOM_ALLOC_HEAP)
+      : m_filter(items, error, alloc, hashSeed),
+        m_summary(make_summary(items, error, summary_bytes, hashSeed)) {}
+
+  /** Insert a key. */
+  template<typename T>
+  inline void add(const T key) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    add_hash(m_filter.key_hash(key));
+  }
+
+  inline void add(const std::string &key) { add_hash(m_filter.key_hash(key)); }
+
+  inline void add(const char *key, size_t len) {
+    add_hash(m_filter.key_hash(key, len));
+  }
+
+  /** Check whether an object is contained. */
+  template<typename T>
+  inline bool contains(const T key) {
+    static_assert(std::is_integral<T>::value, "Integral Only");
+    return contains_hash(m_filter.key_hash(key));
+  }
+
+  inline bool contains(const std::string &key) {
+    return contains_hash(m_filter.key_hash(key));
+  }
+
+  inline bool contains(const char *key, size_t len) {
+    return contains_hash(m_filter.key_hash(key, len));
+  }
+
+  /** Return the estimated false positive rate of the summary, i.e. the
+   * share of negative lookups which reach the large filter. */
+  inline double summary_fpp() const { return m_summary.effective_fpp(); }
+
+  /** Return the estimated false positive rate of both levels together. */
+  inline double effective_fpp() const {
+    return m_summary.effective_fpp() * m_filter.effective_fpp();
+  }
+
+  /** Return the size of the bitmaps of both levels, in bytes. */
+  inline size_t byte_size() const {
+    return m_summary.byte_size() + m_filter.byte_size();
+  }
+
+  /** Return the large filter. */
+  inline const BloomFilter &filter() const { return m_filter; }
+
+  /** Return the summary filter. */
+  inline const BloomFilter &summary() const { return m_summary; }
+
+  /** Reset both levels. */
+  inline void reset() {
+    m_summary.reset();
+    m_filter.reset();
+  }
+
+ private:
+  static const size_t DEFAULT_SUMMARY_BYTES = 512u << 10u;
+
+  /** A power of two filter of `summary_bytes` for `items` items, but no
+   * more accurate than the large filter. */
+  static BloomFilter make_summary(size_t items, double error,
+                                  size_t summary_bytes, unsigned hashSeed) {
+    if (summary_bytes == 0) {
+      long l2 = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+      l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+      summary_bytes = l2 > 0 ? (size_t) l2 / 2 : DEFAULT_SUMMARY_BYTES;
+    }
+    size_t bytes = 8;
+    while (bytes * 2 <= summary_bytes) bytes *= 2;
+    // bits per entry just below the target, so that the power of two
+    // sizing does not round up to twice the target
+    double bpe = bytes * 8 * 0.99 / items;
+    double summary_error = std::exp(-bpe * 0.480453013918201);  // ln(2)^2
+    return BloomFilter::power_of_two(items, std::max(summary_error, error),
+                                     hashSeed);
+  }
+
+  /** The hashes the summary probes for a key: both hashes of the large
+   * filter remixed (splitmix64), so that the two levels probe unrelated
+   * bits. */
+  static inline KeyHash summary_hash(const KeyHash &h) {
+    KeyHash s = h;
+    s.a = mix(h.a ^ 0x9e3779b97f4a7c15ull);
+    s.b = mix(h.b + 0xbf58476d1ce4e5b9ull);
+    return s;
+  }
+
+  static inline uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30u)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27u)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31u);
+  }
+
+  inline void add_hash(const KeyHash &h) {
+    m_summary.add_hash(summary_hash(h));
+    m_filter.add_hash(h);
+  }
+
+  inline bool contains_hash(const KeyHash &h) {
+    return m_summary.contains_hash(summary_hash(h)) &&
+           m_filter.contains_hash(h);
+  }
+
+  BloomFilter m_filter;
+  BloomFilter m_summary;
+};
+
+#endif // TIERED_BLOOM_FILTER_H_
@@ -9,6 +9,7 @@
 #include "BloomFilter.h"
 #include "bf/all.hpp"
 #include "bloom_filter.hpp"
+#include "perf_counters.h"
 #include "random.h"
 #include "timing.h"
 
@@ -62,7 +63,10 @@ Metrics BloomFilterBenchmark(size_t add_count, double error) {
   auto f = create_bf<BF>(add_count, error);
 
   uint64_t start_time, constr_time, check_time;
+  struct perf_counters pc;
+  perf_counters_open(&pc);
 
+  perf_counters_start(&pc);
   start_time = NowNanos();
   for (size_t i = 0; i < add_count; ++i)
     if constexpr (is_same<BF, bloom_filter>::value)
@@ -70,11 +74,14 @@ Metrics BloomFilterBenchmark(size_t add_count, double error) {
     else
       f.add(input[i]);
   constr_time = NowNanos() - start_time;
+  perf_counters_stop(&pc);
+  perf_counters_print(&pc, stderr, "insert", add_count);
 
   // Count false positives:
   size_t false_positive_count = 0;
   size_t absent = FPR_SAMPLE_SIZE;
 
+  perf_counters_start(&pc);
   start_time = NowNanos();
   for (size_t i = add_count; i < check_end; ++i)
     if constexpr (std::is_same<BF, bf::basic_bloom_filter>::value)
@@ -82,6 +89,9 @@ Metrics BloomFilterBenchmark(size_t add_count, double error) {
     else
       false_positive_count += (f.contains(input[i]) ? 1 : 0);
   check_time = NowNanos() - start_time;
+  perf_counters_stop(&pc);
+  perf_counters_print(&pc, stderr, "lookup", FPR_SAMPLE_SIZE);
+  perf_counters_close(&pc);
 
   // Calculate metrics:
   const auto time = constr_time / static_cast<double>(1000 * 1000 * 1000);
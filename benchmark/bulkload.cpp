@@ -0,0 +1,111 @@
+// Bulk insert speed by filter size: bloom_add_ns() key by key against
+// bloom_add_many(), which sets the bits of a batch region by region.
+//
+// For bitmaps of 1 MiB up to the given size (doubling), an empty filter is
+// loaded to its capacity with random 64-bit keys, once per method, and the
+// speed in million keys per second is reported as CSV. Methods:
+//
+//   naive          - add() of every key
+//   partitioned    - add_many() of all keys
+//   naive-mt       - add_atomic() of every key, from THREADS threads
+//   partitioned-mt - add_many_atomic() of a share of the keys per thread
+//
+// The -mt methods are only run with -t THREADS (> 1).
+//
+//   bf_bulkload [-s MAX_MIB] [-t THREADS] [-o OUTPUT]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "BloomFilter.h"
+#include "random.h"
+#include "timing.h"
+
+using namespace std;
+
+const char *RESULT_HEADER =
+    "method,threads,bytes,keys,speed (million keys/sec)";
+const char *RESULT_FMT = "%s,%u,%lu,%lu,%.3f\n";
+
+// bits per entry at an error of 1%
+const double BITS_PER_ENTRY = 9.585;
+
+enum Method { NAIVE, PARTITIONED, NAIVE_MT, PARTITIONED_MT };
+const char *METHOD_NAMES[] = {"naive", "partitioned", "naive-mt",
+                              "partitioned-mt"};
+
+static void load(BloomFilter &bf, Method method, unsigned threads,
+                 const vector<uint64_t> &keys) {
+  if (method == NAIVE) {
+    for (uint64_t key : keys) bf.add(key);
+    return;
+  }
+  if (method == PARTITIONED) {
+    bf.add_many(keys.data(), keys.size());
+    return;
+  }
+  vector<thread> workers;
+  size_t share = (keys.size() + threads - 1) / threads;
+  for (unsigned t = 0; t < threads; ++t) {
+    size_t begin = min(keys.size(), t * share);
+    size_t end = min(keys.size(), begin + share);
+    workers.emplace_back([&, begin, end]() {
+      if (method == NAIVE_MT) {
+        for (size_t i = begin; i < end; ++i) bf.add_atomic(keys[i]);
+      } else {
+        bf.add_many_atomic(keys.data() + begin, end - begin);
+      }
+    });
+  }
+  for (thread &w : workers) w.join();
+}
+
+int main(int argc, char **argv) {
+  size_t max_mib = 1024;
+  unsigned threads = 1;
+  const char *filename = "bulkload_results.csv";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-s"))
+      max_mib = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-t"))
+      threads = (unsigned) atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-o"))
+      filename = argv[i + 1];
+  }
+
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to create file %s\n", filename);
+    exit(1);
+  }
+  fprintf(fp, "%s\n", RESULT_HEADER);
+  fprintf(stdout, "%s\n", RESULT_HEADER);
+
+  vector<Method> methods({NAIVE, PARTITIONED});
+  if (threads > 1) {
+    methods.push_back(NAIVE_MT);
+    methods.push_back(PARTITIONED_MT);
+  }
+  for (size_t mib = 1; mib <= max_mib; mib *= 2) {
+    size_t entries = (size_t) (mib * 8.0 * 1024 * 1024 / BITS_PER_ENTRY);
+    vector<uint64_t> keys = GenerateRandom64(entries);
+    for (Method method : methods) {
+      unsigned used = method == NAIVE_MT || method == PARTITIONED_MT ? threads
+                                                                     : 1;
+      BloomFilter bf(entries, 0.01);
+      uint64_t start = NowNanos();
+      load(bf, method, used, keys);
+      double speed = keys.size() * 1e3 / (NowNanos() - start);
+      for (FILE *out : {fp, stdout}) {
+        fprintf(out, RESULT_FMT, METHOD_NAMES[method], used,
+                (unsigned long) bf.byte_size(), (unsigned long) keys.size(),
+                speed);
+      }
+    }
+  }
+  fclose(fp);
+}
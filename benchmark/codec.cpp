@@ -0,0 +1,104 @@
+// Size and speed of the serialized forms of a filter at different loads.
+//
+// For filters loaded with 1% to 100% of their capacity, the filter is
+// serialized with bloom_serialize() ("plain") and with
+// bloom_serialize_compressed() for every codec, and read back with
+// bloom_deserialize(). Reported are the encoded size, its ratio to the plain
+// size and the encode and decode throughput in GB/s of bitmap, as CSV.
+//
+//   bf_codec [-n ENTRIES] [-e ERROR] [-o OUTPUT]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "BloomFilter.h"
+#include "timing.h"
+
+using namespace std;
+
+const vector<double> LOADS({0.01, 0.05, 0.1, 0.25, 0.5, 1.0});
+// every measurement is repeated for at least this long
+const uint64_t MIN_NANOS = 200 * 1000 * 1000;
+const char *RESULT_HEADER =
+    "load,fill ratio,codec,bitmap bytes,encoded bytes,ratio,encode (GB/s),"
+    "decode (GB/s)";
+const char *RESULT_FMT = "%.2f,%.4f,%s,%lu,%lu,%.4f,%.3f,%.3f\n";
+
+struct Codec {
+  const char *name;
+  int codec;  // -2 for bloom_serialize()
+};
+const vector<Codec> CODECS({{"plain", -2},
+                            {"raw", BLOOM_CODEC_RAW},
+                            {"rice", BLOOM_CODEC_RICE},
+                            {"auto", BLOOM_CODEC_AUTO}});
+
+static vector<unsigned char> encode(const BloomFilter &bf, int codec) {
+  return codec == -2 ? bf.serialize() : bf.serialize_compressed(codec);
+}
+
+/** Bitmap bytes per nanosecond (= GB/s) of `op`, repeated for MIN_NANOS. */
+template <typename Op>
+static double throughput(size_t bytes, Op op) {
+  uint64_t start = NowNanos(), elapsed;
+  size_t rounds = 0;
+  do {
+    op();
+    rounds++;
+    elapsed = NowNanos() - start;
+  } while (elapsed < MIN_NANOS);
+  return (double) bytes * rounds / elapsed;
+}
+
+int main(int argc, char **argv) {
+  size_t entries = 10 * 1000 * 1000;
+  double error = 0.01;
+  const char *filename = "codec_results.csv";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-n"))
+      entries = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-e"))
+      error = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-o"))
+      filename = argv[i + 1];
+  }
+
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to create file %s\n", filename);
+    exit(1);
+  }
+  fprintf(fp, "%s\n", RESULT_HEADER);
+  fprintf(stdout, "%s\n", RESULT_HEADER);
+
+  mt19937_64 rng(42);
+  for (double load : LOADS) {
+    BloomFilter bf(entries, error);
+    for (size_t i = 0; i < (size_t) (load * entries); ++i) bf.add(rng());
+    double fill = (double) bf.popcount() / bf.size();
+    size_t plain = bf.serialized_size();
+
+    for (const Codec &c : CODECS) {
+      vector<unsigned char> data = encode(bf, c.codec);
+      double enc = throughput(bf.byte_size(), [&]() {
+        vector<unsigned char> out = encode(bf, c.codec);
+        if (out.size() != data.size()) throw runtime_error("unstable");
+      });
+      double dec = throughput(bf.byte_size(), [&]() {
+        BloomFilter copy = BloomFilter::deserialize(data.data(), data.size());
+        if (copy.byte_size() != bf.byte_size()) throw runtime_error("decode");
+      });
+      for (FILE *out : {fp, stdout}) {
+        fprintf(out, RESULT_FMT, load, fill, c.name,
+                (unsigned long) bf.byte_size(), (unsigned long) data.size(),
+                (double) data.size() / plain, enc, dec);
+      }
+    }
+  }
+  fclose(fp);
+}
@@ -0,0 +1,224 @@
+// Google Benchmark based microbenchmarks of the hash functions a filter can
+// use (see bloom_set_hash()), independent of the filter itself.
+//
+// For every hash compiled in, keys of 4 to 4096 bytes are hashed at offsets
+// of 0, 1 and 3 bytes from a 64-byte boundary. Two benchmarks per key:
+//
+//   hash/NAME/len:L/align:A  - one call, fn(key, len, seed)
+//   pair/NAME/len:L/align:A  - both hashes of a filter operation,
+//                              a = fn(key, len, seed), b = fn(key, len, a)
+//
+// The reported time is ns per hash (or per pair), bytes/s the hashing
+// throughput. There are no batched or vectorized hash implementations in
+// the library, so only the scalar functions are measured.
+//
+//   bf_hashbench --benchmark_filter='hash/.*/align:0'
+//
+// With --bf_distribution, the benchmarks are skipped and the double hashing
+// indices (a + i * b) % bits are checked for uniformity instead: for a few
+// key patterns, a filter is loaded to its design capacity and the set bits
+// are counted in BUCKETS equally sized regions of the bitmap. The chi-square
+// statistic of the counts over its degrees of freedom should be close to 1,
+// and the false positive rate of absent keys close to the design rate. For
+// the collision behavior of large filters, see `make collision_test HASH=...`
+// and misc/collisions/dograph.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "BloomFilter.h"
+
+namespace {
+
+const std::vector<int> KEY_LENGTHS({4, 8, 16, 32, 64, 128, 256, 512, 1024,
+                                    4096});
+const std::vector<int> ALIGNMENTS({0, 1, 3});
+// Number of different keys hashed in turn, so that a benchmark does not
+// hash the very same bytes over and over.
+const size_t KEYS = 64;
+const size_t BUCKETS = 1024;
+
+/** KEYS keys of `len` bytes, each starting `align` bytes past a 64-byte
+ * boundary. */
+class KeyBuffer {
+ public:
+  KeyBuffer(int len, int align)
+      : stride_((len + align + 63) / 64 * 64), align_(align) {
+    data_.resize(KEYS * stride_ + 64);
+    std::mt19937_64 rng(len);
+    for (auto &c : data_) c = (unsigned char) rng();
+    auto base = reinterpret_cast<uintptr_t>(data_.data());
+    offset_ = (64 - base % 64) % 64 + align_;
+  }
+
+  inline const unsigned char *key(size_t i) const {
+    return data_.data() + offset_ + (i % KEYS) * stride_;
+  }
+
+ private:
+  size_t stride_, align_, offset_;
+  std::vector<unsigned char> data_;
+};
+
+void BM_Hash(benchmark::State &state, bloom_hash_fn fn, int len, int align) {
+  KeyBuffer keys(len, align);
+  uint64_t sum = 0;
+  size_t i = 0;
+  for (auto _ : state) {
+    sum += fn(keys.key(i++), len, 0x9747b28c);
+  }
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * len);
+}
+
+void BM_Pair(benchmark::State &state, bloom_hash_fn fn, int len, int align) {
+  KeyBuffer keys(len, align);
+  uint64_t sum = 0;
+  size_t i = 0;
+  for (auto _ : state) {
+    const unsigned char *key = keys.key(i++);
+    uint64_t a = fn(key, len, 0x9747b28c);
+    sum += a + fn(key, len, a);
+  }
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * 2 * len);
+}
+
+void register_benchmarks() {
+  for (int id = 0; id < BLOOM_HASH_COUNT; ++id) {
+    bloom_hash_fn fn = bloom_hash_function(id);
+    if (fn == nullptr) continue;
+    for (const char *kind : {"hash", "pair"}) {
+      for (int len : KEY_LENGTHS) {
+        for (int align : ALIGNMENTS) {
+          std::string name = std::string(kind) + "/" + bloom_hash_name(id) +
+                             "/len:" + std::to_string(len) +
+                             "/align:" + std::to_string(align);
+          benchmark::RegisterBenchmark(name.c_str(),
+                                       kind[0] == 'h' ? BM_Hash : BM_Pair, fn,
+                                       len, align);
+        }
+      }
+    }
+  }
+}
+
+/** Key `i` of a pattern, written to `buf`; returns its length. */
+typedef std::function<int(uint64_t i, unsigned char *buf)> KeyPattern;
+
+struct NamedPattern {
+  const char *name;
+  KeyPattern key;
+};
+
+std::vector<NamedPattern> key_patterns() {
+  return {
+      {"sequential-u64",
+       [](uint64_t i, unsigned char *buf) {
+         std::memcpy(buf, &i, sizeof(i));
+         return (int) sizeof(i);
+       }},
+      {"random-u64",
+       [](uint64_t i, unsigned char *buf) {
+         std::mt19937_64 rng(i);
+         uint64_t v = rng();
+         std::memcpy(buf, &v, sizeof(v));
+         return (int) sizeof(v);
+       }},
+      {"string",
+       [](uint64_t i, unsigned char *buf) {
+         return snprintf((char *) buf, 32, "user:%llu", (unsigned long long) i);
+       }},
+      {"random-32",
+       [](uint64_t i, unsigned char *buf) {
+         std::mt19937_64 rng(i);
+         for (int j = 0; j < 32; j += 8) {
+           uint64_t v = rng();
+           std::memcpy(buf + j, &v, sizeof(v));
+         }
+         return 32;
+       }},
+  };
+}
+
+/** chi-square / degrees of freedom of the set bits per bitmap region. The
+ * count of a region with `n` bits is binomial with variance n * p * (1 - p),
+ * p the fill ratio. */
+double region_chi2(const BloomFilter &bf) {
+  const unsigned char *bitmap = bf.bitmap();
+  size_t region_bytes = bf.size() / 8 / BUCKETS;
+  double p = (double) bf.popcount() / bf.size();
+  double expected = region_bytes * 8 * p, variance = expected * (1 - p);
+  double chi2 = 0;
+  for (size_t r = 0; r < BUCKETS; ++r) {
+    size_t set = 0;
+    for (size_t j = 0; j < region_bytes; ++j) {
+      set += __builtin_popcount(bitmap[r * region_bytes + j]);
+    }
+    chi2 += (set - expected) * (set - expected) / variance;
+  }
+  return chi2 / (BUCKETS - 1);
+}
+
+int run_distribution(size_t entries, double error) {
+  printf("hash,keys,entries,error,hashes,fill ratio,chi2/df,expected "
+         "fpr,observed fpr\n");
+  unsigned char buf[64];
+  for (int id = 0; id < BLOOM_HASH_COUNT; ++id) {
+    if (!bloom_hash_available(id)) continue;
+    for (const auto &pattern : key_patterns()) {
+      BloomFilter bf(entries, error, (enum bloom_hash) id);
+      for (uint64_t i = 0; i < entries; ++i) {
+        bf.add(buf, pattern.key(i, buf));
+      }
+      size_t found = 0;
+      for (uint64_t i = entries; i < 2 * entries; ++i) {
+        found += bf.contains(buf, pattern.key(i, buf));
+      }
+      printf("%s,%s,%lu,%g,%lu,%.4f,%.3f,%.6f,%.6f\n", bloom_hash_name(id),
+             pattern.name, (unsigned long) entries, error,
+             (unsigned long) bf.num_hashes(),
+             (double) bf.popcount() / bf.size(), region_chi2(bf),
+             bf.effective_fpp(), (double) found / entries);
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  benchmark::Initialize(&argc, argv);
+  bool distribution = false;
+  size_t entries = 1000000;
+  double error = 0.01;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--bf_distribution") == 0) {
+      distribution = true;
+    } else if (std::strncmp(argv[i], "--bf_entries=", 13) == 0) {
+      entries = std::strtoull(argv[i] + 13, nullptr, 10);
+    } else if (std::strncmp(argv[i], "--bf_error=", 11) == 0) {
+      error = std::atof(argv[i] + 11);
+    } else {
+      fprintf(stderr, "unrecognized argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (distribution) return run_distribution(entries, error);
+
+  register_benchmarks();
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,97 @@
+// K-mer insertion and screening speed: add() and contains() of every k-mer
+// substring against add_kmers() and count_kmer_hits(), which roll ntHash
+// along the read.
+//
+// READS random reads of LENGTH bases are inserted k-mer by k-mer, then as
+// many other reads are screened, for k = 15 up to 63 (step 16). Speeds are
+// reported in million k-mers per second as CSV, along with the fraction of
+// k-mers of the other reads found (false positives).
+//
+//   bf_kmers [-r READS] [-l LENGTH] [-o OUTPUT]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BloomFilter.h"
+#include "timing.h"
+
+using namespace std;
+
+const char *RESULT_HEADER =
+    "method,k,k-mers,insert (million k-mers/sec),screen (million "
+    "k-mers/sec),false positive rate";
+const char *RESULT_FMT = "%s,%u,%lu,%.3f,%.3f,%.6f\n";
+
+static vector<string> random_reads(mt19937_64 &rng, size_t reads,
+                                   size_t length) {
+  vector<string> out(reads);
+  for (string &read : out) {
+    read.resize(length);
+    for (char &base : read) base = "ACGT"[rng() & 3u];
+  }
+  return out;
+}
+
+int main(int argc, char **argv) {
+  size_t reads = 100 * 1000, length = 150;
+  const char *filename = "kmers_results.csv";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-r"))
+      reads = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-l"))
+      length = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-o"))
+      filename = argv[i + 1];
+  }
+
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to create file %s\n", filename);
+    exit(1);
+  }
+  fprintf(fp, "%s\n", RESULT_HEADER);
+  fprintf(stdout, "%s\n", RESULT_HEADER);
+
+  mt19937_64 rng(42);
+  vector<string> genome = random_reads(rng, reads, length);
+  vector<string> screened = random_reads(rng, reads, length);
+  for (unsigned k = 15; k <= 63 && k <= length; k += 16) {
+    size_t kmers = reads * (length - k + 1);
+    for (bool rolling : {false, true}) {
+      BloomFilter bf(kmers, 0.01);
+      size_t hits = 0;
+      uint64_t start = NowNanos();
+      if (rolling) {
+        for (const string &read : genome) bf.add_kmers(read, k);
+      } else {
+        for (const string &read : genome) {
+          for (size_t i = 0; i + k <= read.size(); ++i) {
+            bf.add(read.c_str() + i, k);
+          }
+        }
+      }
+      double insert = kmers * 1e3 / (NowNanos() - start);
+      start = NowNanos();
+      if (rolling) {
+        for (const string &read : screened) hits += bf.count_kmer_hits(read, k);
+      } else {
+        for (const string &read : screened) {
+          for (size_t i = 0; i + k <= read.size(); ++i) {
+            hits += bf.contains(read.c_str() + i, k);
+          }
+        }
+      }
+      double screen = kmers * 1e3 / (NowNanos() - start);
+      for (FILE *out : {fp, stdout}) {
+        fprintf(out, RESULT_FMT, rolling ? "rolling" : "substring", k,
+                (unsigned long) kmers, insert, screen,
+                (double) hits / kmers);
+      }
+    }
+  }
+  fclose(fp);
+}
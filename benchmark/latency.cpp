@@ -0,0 +1,255 @@
+// Per-operation latency distribution of add() and contains().
+//
+// Every operation (or every batch of `-b` operations, reported per operation)
+// is timed on its own, with rdtscp on x86-64 and steady_clock elsewhere, and
+// recorded in a log-linear histogram. The timer overhead, measured up front,
+// is subtracted. Filter sizes range from cache-resident to DRAM-resident, in
+// three variants:
+//
+//   warm      - bitmap from malloc(), caches warmed by the preceding samples
+//   hugepage  - bitmap on 2 MiB aligned memory advised MADV_HUGEPAGE, which
+//               removes most of the TLB misses of large filters
+//   cold      - the bitmap is flushed from all caches (clflush) before every
+//               sample; x86 only. Flushing costs time proportional to the
+//               filter size, so larger filters get fewer cold samples and
+//               filters above 64 MiB, whose lookups miss the caches anyway,
+//               are skipped
+//
+// Lookups hit an inserted key half of the time. Results (p50, p90, p99,
+// p99.9, max and mean in nanoseconds) are written as CSV.
+//
+//   bf_latency [-e ERROR] [-s SAMPLES] [-b BATCH] [-m MAX_BYTES] [-o OUTPUT]
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSCP 1
+#define HAVE_CLFLUSH 1
+#endif
+
+#include "BloomFilter.h"
+#include "histogram.h"
+#include "timing.h"
+
+using namespace std;
+
+const size_t KiB = 1024, MiB = 1024 * KiB, GiB = 1024 * MiB;
+const vector<size_t> FILTER_BYTES({32 * KiB, 1 * MiB, 16 * MiB, 64 * MiB,
+                                   256 * MiB, 1 * GiB, 4 * GiB});
+const size_t HUGE_PAGE = 2 * MiB;
+const size_t STREAM_SIZE = 1 << 20;
+// cache lines flushed per (filter size, operation) in the cold variant
+const size_t COLD_FLUSH_BUDGET = 1ul << 25;
+const size_t MIN_COLD_SAMPLES = 100;
+const size_t COLD_MAX_BYTES = 64 * MiB;
+const char *RESULT_HEADER =
+    "operation,variant,filter bytes,batch,samples,p50 (ns),p90 (ns),p99 "
+    "(ns),p99.9 (ns),max (ns),mean (ns)";
+const char *RESULT_FMT = "%s,%s,%lu,%u,%lu,%lu,%lu,%lu,%lu,%lu,%.2f\n";
+
+enum Variant { WARM, HUGEPAGE, COLD };
+const char *VARIANT_NAMES[] = {"warm", "hugepage", "cold"};
+
+/** Cycle counter (or nanoseconds without rdtscp) and its conversion to ns. */
+class Timer {
+ public:
+  Timer() {
+#ifdef HAVE_RDTSCP
+    // calibrate the TSC against steady_clock
+    uint64_t n0 = NowNanos(), t0 = now();
+    this_thread::sleep_for(chrono::milliseconds(50));
+    uint64_t n1 = NowNanos(), t1 = now();
+    ns_per_tick_ = (double) (n1 - n0) / (double) (t1 - t0);
+#endif
+    // the cheapest of many empty intervals is the cost of timing itself
+    overhead_ = UINT64_MAX;
+    for (int i = 0; i < 10000; ++i) {
+      uint64_t start = now();
+      overhead_ = min(overhead_, now() - start);
+    }
+  }
+
+  static inline uint64_t now() {
+#ifdef HAVE_RDTSCP
+    unsigned aux;
+    return __rdtscp(&aux);
+#else
+    return NowNanos();
+#endif
+  }
+
+  /** Nanoseconds per operation of an interval of `ops` operations. */
+  inline uint64_t nanos(uint64_t ticks, unsigned ops) const {
+    ticks = ticks > overhead_ ? ticks - overhead_ : 0;
+    return (uint64_t) (ticks * ns_per_tick_ / ops + 0.5);
+  }
+
+ private:
+  double ns_per_tick_ = 1.0;
+  uint64_t overhead_;
+};
+
+/** Evicts the bitmap of `bf` from all cache levels. */
+static void flush_filter(const BloomFilter &bf) {
+#ifdef HAVE_CLFLUSH
+  const unsigned char *p = bf.bitmap();
+  for (size_t i = 0; i < bf.byte_size(); i += 64) _mm_clflush(p + i);
+  _mm_mfence();
+#else
+  (void) bf;
+#endif
+}
+
+/** A filter of (about) `bytes` bytes at its design load, see microbench.cpp:
+ * the bitmap is filled with random words, then the first `inserted` keys
+ * (at most entries / 8) are added. */
+static unique_ptr<BloomFilter> loaded_filter(size_t bytes, double error,
+                                             Variant variant,
+                                             const vector<uint64_t> &keys,
+                                             size_t &inserted) {
+  size_t entries = (size_t) ((double) bytes * 8 * 0.480453013918201 /
+                             -log(error));
+  struct bloom shape {};
+  bloom_init_wo_allocation(&shape, entries, error);
+
+  unsigned char *raw = nullptr;
+  if (variant == HUGEPAGE) {
+    size_t rounded = (shape.bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    if (posix_memalign((void **) &raw, HUGE_PAGE, rounded) == 0) {
+#ifdef MADV_HUGEPAGE
+      madvise(raw, rounded, MADV_HUGEPAGE);
+#endif
+    }
+  } else {
+    raw = (unsigned char *) malloc(shape.bytes);
+  }
+  if (raw == nullptr) throw runtime_error("Out of memory");
+
+  mt19937_64 rng(bytes);
+  for (size_t i = 0; i + sizeof(uint64_t) <= shape.bytes; i += sizeof(uint64_t)) {
+    uint64_t w = rng();
+    memcpy(raw + i, &w, sizeof(w));
+  }
+  memset(raw + shape.bytes / 8 * 8, 0, shape.bytes % 8);
+
+  unique_ptr<BloomFilter> bf(new BloomFilter(entries, error, raw, shape.bytes));
+  inserted = max<size_t>(1, min(keys.size(), entries / 8));
+  bf->add_many(keys.data(), inserted);
+  return bf;
+}
+
+/** Lookups of which half hit one of the first `inserted` keys. */
+static vector<uint64_t> lookup_stream(const vector<uint64_t> &keys,
+                                      size_t inserted) {
+  vector<uint64_t> stream(STREAM_SIZE);
+  mt19937_64 rng(inserted);
+  for (auto &key : stream) key = (rng() & 1) ? keys[rng() % inserted] : rng();
+  return stream;
+}
+
+static LatencyHistogram measure(BloomFilter &bf, bool add, unsigned batch,
+                                size_t samples, const vector<uint64_t> &stream,
+                                const Timer &timer, bool cold) {
+  LatencyHistogram hist;
+  size_t found = 0, pos = 0;
+  for (size_t s = 0; s < samples; ++s) {
+    if (cold) flush_filter(bf);
+    uint64_t start = Timer::now();
+    for (unsigned j = 0; j < batch; ++j, ++pos) {
+      const uint64_t key = stream[pos % stream.size()];
+      if (add)
+        bf.add(key);
+      else
+        found += bf.contains(key);
+    }
+    uint64_t ticks = Timer::now() - start;
+    hist.record(timer.nanos(ticks, batch));
+  }
+  volatile size_t sink = found;
+  (void) sink;
+  return hist;
+}
+
+int main(int argc, char **argv) {
+  double error = 0.01;
+  size_t samples = 1000 * 1000;
+  unsigned batch = 1;
+  size_t max_bytes = 1 * GiB;
+  const char *filename = "latency_results.csv";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-e"))
+      error = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-s"))
+      samples = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-b"))
+      batch = max(1, atoi(argv[i + 1]));
+    else if (!strcmp(argv[i], "-m"))
+      max_bytes = strtoull(argv[i + 1], nullptr, 10);
+    else if (!strcmp(argv[i], "-o"))
+      filename = argv[i + 1];
+  }
+
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to create file %s\n", filename);
+    exit(1);
+  }
+  fprintf(fp, "%s\n", RESULT_HEADER);
+  fprintf(stdout, "%s\n", RESULT_HEADER);
+
+  Timer timer;
+  mt19937_64 rng(42);
+  vector<uint64_t> keys(STREAM_SIZE), additions(STREAM_SIZE), lookups;
+  for (auto &k : keys) k = rng();
+  for (auto &k : additions) k = rng();
+
+  for (size_t bytes : FILTER_BYTES) {
+    if (bytes > max_bytes) continue;
+    for (Variant variant : {WARM, HUGEPAGE, COLD}) {
+#ifdef HAVE_CLFLUSH
+      if (variant == COLD && bytes > COLD_MAX_BYTES) continue;
+#else
+      if (variant == COLD) continue;
+#endif
+      size_t inserted;
+      auto bf = loaded_filter(bytes, error, variant, keys, inserted);
+      lookups = lookup_stream(keys, inserted);
+      size_t n = samples;
+      if (variant == COLD) {
+        n = min(samples, max(MIN_COLD_SAMPLES,
+                             COLD_FLUSH_BUDGET / (bf->byte_size() / 64 + 1)));
+      }
+      for (bool add : {false, true}) {
+        // `add` runs last since it changes the filter
+        LatencyHistogram hist = measure(*bf, add, batch, n,
+                                        add ? additions : lookups, timer,
+                                        variant == COLD);
+        for (FILE *out : {fp, stdout}) {
+          fprintf(out, RESULT_FMT, add ? "add" : "contains",
+                  VARIANT_NAMES[variant], (unsigned long) bf->byte_size(),
+                  batch, (unsigned long) hist.count(),
+                  (unsigned long) hist.percentile(0.5),
+                  (unsigned long) hist.percentile(0.9),
+                  (unsigned long) hist.percentile(0.99),
+                  (unsigned long) hist.percentile(0.999),
+                  (unsigned long) hist.max(), hist.mean());
+        }
+      }
+    }
+  }
+  fclose(fp);
+}
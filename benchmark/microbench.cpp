@@ -0,0 +1,304 @@
+// Google Benchmark based microbenchmarks for BloomFilter.
+//
+// Every benchmark performs one add() or contains() per iteration, so the
+// reported time is the per-operation latency; items/s and bytes/s (key bytes
+// hashed) are reported as counters. Use the usual Google Benchmark flags for
+// repetitions and output, e.g.
+//
+//   bf_microbench --benchmark_repetitions=5 --benchmark_format=json
+//   bf_microbench --benchmark_filter='contains/u64/.*' --bf_max_bytes=17179869184
+//
+// The sweep covers filter sizes from L1-resident up to 16 GiB (limited by
+// --bf_max_bytes, 1 GiB by default), desired error rates, key types, hash
+// functions (those compiled in) and the fraction of lookups which hit an
+// inserted key.
+//
+// Where perf_event_open is permitted, hardware counters (cycles,
+// instructions, cache/TLB and branch misses) are reported per operation as
+// well.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "BloomFilter.h"
+#include "perf_counters.h"
+
+namespace {
+
+const size_t KiB = 1024, MiB = 1024 * KiB, GiB = 1024 * MiB;
+const std::vector<size_t> FILTER_BYTES({16 * KiB, 256 * KiB, 8 * MiB,
+                                        256 * MiB, 4 * GiB, 16 * GiB});
+const std::vector<double> TEST_ERROR({0.1, 0.01, 0.001});
+const std::vector<double> HIT_RATIOS({0.0, 0.5, 0.9, 1.0});
+const std::vector<size_t> STRING_LENGTHS({8, 16, 64, 256});
+
+// Pool of distinct keys: the first half is inserted, the second half never
+// is. The pool is capped at 64 MiB of key material.
+const size_t MAX_POOL_KEYS = 1 << 20;
+const size_t MAX_POOL_BYTES = 64 * MiB;
+// Length of the precomputed lookup stream (a power of two).
+const size_t STREAM_SIZE = 1 << 20;
+
+size_t bf_max_bytes = 1 * GiB;
+
+std::string human_bytes(size_t bytes) {
+  if (bytes >= GiB) return std::to_string(bytes / GiB) + "G";
+  if (bytes >= MiB) return std::to_string(bytes / MiB) + "M";
+  return std::to_string(bytes / KiB) + "K";
+}
+
+/** Keys of fixed length `len`, stored back to back. Positive and negative
+ * keys differ in the lowest bit of their first byte, so the two halves are
+ * disjoint. */
+class KeyPool {
+ public:
+  KeyPool(std::string name, size_t len, bool integral)
+      : name_(std::move(name)), len_(len), integral_(integral) {
+    size_t count = std::min(MAX_POOL_KEYS, MAX_POOL_BYTES / len);
+    half_ = count / 2;
+    data_.resize(count * len);
+    std::mt19937_64 rng(0x9747b28c + len);
+    for (size_t i = 0; i < count; ++i) {
+      unsigned char *key = &data_[i * len];
+      for (size_t j = 0; j < len; ++j) {
+        // printable keys for strings, full range for integers
+        key[j] = integral ? (unsigned char) rng()
+                          : (unsigned char) ('!' + rng() % 94);
+      }
+      key[0] = (unsigned char) ((key[0] & ~1u) | (i >= half_ ? 1u : 0u));
+    }
+  }
+
+  const std::string &name() const { return name_; }
+  size_t key_len() const { return len_; }
+  size_t positives() const { return half_; }
+  const unsigned char *positive(size_t i) const { return &data_[i * len_]; }
+  const unsigned char *negative(size_t i) const {
+    return &data_[(half_ + i) * len_];
+  }
+
+  inline void add(BloomFilter &bf, const unsigned char *key) const {
+    switch (integral_ ? len_ : 0) {
+      case 4: bf.add(load<uint32_t>(key)); break;
+      case 8: bf.add(load<uint64_t>(key)); break;
+      default: bf.add(key, len_);
+    }
+  }
+
+  inline bool contains(BloomFilter &bf, const unsigned char *key) const {
+    switch (integral_ ? len_ : 0) {
+      case 4: return bf.contains(load<uint32_t>(key));
+      case 8: return bf.contains(load<uint64_t>(key));
+      default: return bf.contains(key, len_);
+    }
+  }
+
+ private:
+  template <typename T>
+  static inline T load(const unsigned char *p) {
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  std::string name_;
+  size_t len_;
+  bool integral_;
+  size_t half_;
+  std::vector<unsigned char> data_;
+};
+
+/** Number of entries for which a filter with the given error occupies
+ * `bytes` bytes. */
+size_t entries_for_bytes(size_t bytes, double error) {
+  return (size_t) ((double) bytes * 8 * 0.480453013918201 / -std::log(error));
+}
+
+struct LoadedFilter {
+  std::unique_ptr<BloomFilter> bf;
+  size_t inserted;  // number of pool positives inserted
+};
+
+std::unique_ptr<LoadedFilter> cached;
+std::string cached_id;
+
+/**
+ * A filter of (about) `bytes` bytes at its design load.
+ *
+ * Inserting entries_for_bytes() keys into a multi-GiB filter would take far
+ * longer than the measurement itself. A filter at its optimal load has half
+ * of its bits set, so the bitmap is filled with uniformly random words
+ * instead and up to entries / 8 positive keys of the pool are inserted on
+ * top. Lookups of absent keys then see (about) the design false positive
+ * rate.
+ *
+ * The last filter built is cached, since Google Benchmark calls each
+ * benchmark function several times and adjacent registrations share the
+ * filter.
+ */
+LoadedFilter &loaded_filter(size_t bytes, double error, bloom_hash hash,
+                            const KeyPool &keys) {
+  std::string id = std::to_string(bytes) + "/" + std::to_string(error) + "/" +
+                   bloom_hash_name(hash) + "/" + keys.name();
+  if (cached && cached_id == id) return *cached;
+  cached.reset();
+
+  size_t entries = entries_for_bytes(bytes, error);
+  cached.reset(new LoadedFilter());
+  cached->bf.reset(new BloomFilter(entries, error, hash));
+  // filled in place: a copy through set() would double the memory needed
+  auto *raw = const_cast<unsigned char *>(cached->bf->bitmap());
+  size_t len = cached->bf->byte_size();
+  std::mt19937_64 rng(bytes);
+  size_t words = len / sizeof(uint64_t);
+  for (size_t i = 0; i < words; ++i) {
+    uint64_t w = rng();
+    std::memcpy(raw + i * sizeof(w), &w, sizeof(w));
+  }
+  std::memset(raw + words * sizeof(uint64_t), 0, len % 8);
+
+  cached->inserted =
+      std::max<size_t>(1, std::min(keys.positives(), entries / 8));
+  for (size_t i = 0; i < cached->inserted; ++i) {
+    keys.add(*cached->bf, keys.positive(i));
+  }
+  cached_id = id;
+  return *cached;
+}
+
+/** Drop the cached filter (after keys not accounted for were inserted). */
+void invalidate_filter() { cached.reset(); }
+
+/** Lookup stream in which a fraction `hit_ratio` of the keys is present. */
+std::vector<const unsigned char *> lookup_stream(const KeyPool &keys,
+                                                 size_t inserted,
+                                                 double hit_ratio) {
+  std::vector<const unsigned char *> stream(STREAM_SIZE);
+  std::mt19937_64 rng(42);
+  std::bernoulli_distribution hit(hit_ratio);
+  for (auto &key : stream) {
+    key = hit(rng) ? keys.positive(rng() % inserted)
+                   : keys.negative(rng() % keys.positives());
+  }
+  return stream;
+}
+
+struct perf_counters *hw_counters() {
+  static struct perf_counters pc;
+  static bool opened = false;
+  if (!opened) {
+    perf_counters_open(&pc);
+    opened = true;
+  }
+  return &pc;
+}
+
+void set_counters(benchmark::State &state, const KeyPool &keys,
+                  const BloomFilter &bf) {
+  const struct perf_counters *pc = hw_counters();
+  for (int i = 0; i < PERF_COUNTERS_MAX && pc->available; ++i) {
+    if (pc->value[i] >= 0) {
+      state.counters[std::string(perf_counter_names[i]) + "/op"] =
+          pc->value[i] / state.iterations();
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * keys.key_len());
+  state.counters["filter_bytes"] = (double) bf.byte_size();
+  state.counters["hashes"] = (double) bf.num_hashes();
+}
+
+void BM_Contains(benchmark::State &state, const KeyPool *keys, size_t bytes,
+                 double error, bloom_hash hash, double hit_ratio) {
+  LoadedFilter &loaded = loaded_filter(bytes, error, hash, *keys);
+  BloomFilter &bf = *loaded.bf;
+  auto stream = lookup_stream(*keys, loaded.inserted, hit_ratio);
+  size_t i = 0, found = 0;
+  perf_counters_start(hw_counters());
+  for (auto _ : state) {
+    found += keys->contains(bf, stream[i++ & (STREAM_SIZE - 1)]);
+  }
+  perf_counters_stop(hw_counters());
+  benchmark::DoNotOptimize(found);
+  set_counters(state, *keys, bf);
+  state.counters["positive_ratio"] =
+      benchmark::Counter((double) found / state.iterations());
+}
+
+void BM_Add(benchmark::State &state, const KeyPool *keys, size_t bytes,
+            double error, bloom_hash hash) {
+  LoadedFilter &loaded = loaded_filter(bytes, error, hash, *keys);
+  BloomFilter &bf = *loaded.bf;
+  auto stream = lookup_stream(*keys, loaded.inserted, 0.0);
+  size_t i = 0;
+  perf_counters_start(hw_counters());
+  for (auto _ : state) {
+    keys->add(bf, stream[i++ & (STREAM_SIZE - 1)]);
+  }
+  perf_counters_stop(hw_counters());
+  set_counters(state, *keys, bf);
+  invalidate_filter();
+}
+
+void register_benchmarks(const std::vector<std::unique_ptr<KeyPool>> &pools) {
+  for (const auto &keys : pools) {
+    for (size_t bytes : FILTER_BYTES) {
+      if (bytes > bf_max_bytes) continue;
+      for (double error : TEST_ERROR) {
+        for (int id = 0; id < BLOOM_HASH_COUNT; ++id) {
+          if (!bloom_hash_available(id)) continue;
+          bloom_hash hash = (bloom_hash) id;
+          std::string suffix = keys->name() + "/bytes:" + human_bytes(bytes) +
+                               "/error:" + std::to_string(error).substr(0, 5) +
+                               "/hash:" + bloom_hash_name(id);
+          for (double hit_ratio : HIT_RATIOS) {
+            benchmark::RegisterBenchmark(
+                ("contains/" + suffix + "/hit:" +
+                 std::to_string(hit_ratio).substr(0, 3))
+                    .c_str(),
+                BM_Contains, keys.get(), bytes, error, hash, hit_ratio);
+          }
+          // pollutes the cached filter, so it runs last
+          benchmark::RegisterBenchmark(("add/" + suffix).c_str(), BM_Add,
+                                       keys.get(), bytes, error, hash);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  benchmark::Initialize(&argc, argv);
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--bf_max_bytes=", 15) == 0) {
+      bf_max_bytes = std::strtoull(argv[i] + 15, nullptr, 10);
+    } else {
+      fprintf(stderr, "unrecognized argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::vector<std::unique_ptr<KeyPool>> pools;
+  pools.emplace_back(new KeyPool("u32", sizeof(uint32_t), true));
+  pools.emplace_back(new KeyPool("u64", sizeof(uint64_t), true));
+  for (size_t len : STRING_LENGTHS) {
+    pools.emplace_back(new KeyPool("str" + std::to_string(len), len, false));
+  }
+  register_benchmarks(pools);
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Hardware performance counters (perf_event_open) for the benchmarks.
+ *
+ * Counts cycles, instructions, L1D/LLC misses, dTLB misses and branch
+ * misses of the calling thread (user space only) between
+ * perf_counters_start() and perf_counters_stop(). Counters which cannot be
+ * opened - unsupported by the CPU or the kernel, or not permitted by
+ * /proc/sys/kernel/perf_event_paranoid - are skipped; if none can be
+ * opened `available` is 0 and the benchmarks report wall-clock time only.
+ *
+ * Plain C so it can be used by misc/test/perf.c as well as the C++
+ * benchmarks. On Linux, define _GNU_SOURCE before the first include.
+ */
+
+#ifndef BLOOM_PERF_COUNTERS_H
+#define BLOOM_PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define PERF_COUNTERS_MAX 6
+
+static const char *perf_counter_names[PERF_COUNTERS_MAX] = {
+    "cycles",      "instructions", "L1D-misses",
+    "LLC-misses",  "dTLB-misses",  "branch-misses"};
+
+struct perf_counters {
+  int fd[PERF_COUNTERS_MAX];
+  double value[PERF_COUNTERS_MAX];  // scaled for multiplexing, -1 if n/a
+  int available;                    // number of counters opened
+};
+
+#ifdef __linux__
+
+static inline int perf_counter_open(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#define PERF_CACHE_MISS(cache)                                    \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |                 \
+   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static inline void perf_counters_open(struct perf_counters *pc) {
+  static const uint32_t types[PERF_COUNTERS_MAX] = {
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+      PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+  static const uint64_t configs[PERF_COUNTERS_MAX] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_CACHE_MISS(PERF_COUNT_HW_CACHE_L1D),
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB),
+      PERF_COUNT_HW_BRANCH_MISSES};
+  int i;
+  pc->available = 0;
+  for (i = 0; i < PERF_COUNTERS_MAX; i++) {
+    pc->fd[i] = perf_counter_open(types[i], configs[i]);
+    pc->value[i] = -1;
+    if (pc->fd[i] >= 0) pc->available++;
+  }
+}
+
+static inline void perf_counters_close(struct perf_counters *pc) {
+  int i;
+  for (i = 0; i < PERF_COUNTERS_MAX; i++) {
+    if (pc->fd[i] >= 0) close(pc->fd[i]);
+    pc->fd[i] = -1;
+  }
+  pc->available = 0;
+}
+
+static inline void perf_counters_start(struct perf_counters *pc) {
+  int i;
+  for (i = 0; i < PERF_COUNTERS_MAX; i++) {
+    if (pc->fd[i] < 0) continue;
+    ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+static inline void perf_counters_stop(struct perf_counters *pc) {
+  int i;
+  for (i = 0; i < PERF_COUNTERS_MAX; i++) {
+    if (pc->fd[i] >= 0) ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+  }
+  for (i = 0; i < PERF_COUNTERS_MAX; i++) {
+    uint64_t buf[3];  // value, time enabled, time running
+    pc->value[i] = -1;
+    if (pc->fd[i] < 0 || read(pc->fd[i], buf, sizeof(buf)) != sizeof(buf))
+      continue;
+    pc->value[i] = buf[2] == 0 ? 0 : (double) buf[0] * buf[1] / buf[2];
+  }
+}
+
+#else
+
+static inline void perf_counters_open(struct perf_counters *pc) {
+  int i;
+  for (i = 0; i < PERF_COUNTERS_MAX; i++) {
+    pc->fd[i] = -1;
+    pc->value[i] = -1;
+  }
+  pc->available = 0;
+}
+static inline void perf_counters_close(struct perf_counters *pc) {
+  (void) pc;
+}
+static inline void perf_counters_start(struct perf_counters *pc) {
+  (void) pc;
+}
+static inline void perf_counters_stop(struct perf_counters *pc) {
+  (void) pc;
+}
+
+#endif
+
+/** Print the counters of the last start/stop interval per operation. */
+static inline void perf_counters_print(const struct perf_counters *pc,
+                                       FILE *out, const char *phase,
+                                       uint64_t ops) {
+  int i;
+  if (pc->available == 0 || ops == 0) return;
+  fprintf(out, "  %-8s per op:", phase);
+  for (i = 0; i < PERF_COUNTERS_MAX; i++) {
+    if (pc->value[i] >= 0)
+      fprintf(out, " %s=%.2f", perf_counter_names[i], pc->value[i] / ops);
+  }
+  if (pc->value[0] > 0 && pc->value[1] >= 0)
+    fprintf(out, " IPC=%.2f", pc->value[1] / pc->value[0]);
+  fprintf(out, "\n");
+}
+
+#endif
@@ -200,10 +200,81 @@ def space_plots(csvfile, filter_key, filter_value):
         )
 
 
+WORKLOAD_XLABELS = {
+    "positive": "Fraction of Lookups of Present Keys",
+    "zipf": "Zipf Exponent of Lookup Keys",
+    "interleave": "Fraction of Inserts in the Operation Stream",
+}
+
+
+def workload_plots(csvfile):
+    """plot the output of bf_workloads: speed per scenario and key type"""
+    FIGSIZE = (15.63, 9.00)
+    df = pd.read_csv(csvfile)
+    plot_dir = os.path.join("plots", "workloads")
+    if not os.path.exists(plot_dir):
+        os.makedirs(plot_dir)
+    md = []
+    for scenario in df["scenario"].unique():
+        ddf = df[df["scenario"] == scenario]
+        plt.figure(figsize=FIGSIZE, dpi=MYDPI)
+        for key_type in ddf["key type"].unique():
+            dddf = ddf[ddf["key type"] == key_type]
+            plt.plot(
+                dddf["parameter"].tolist(),
+                dddf["speed (million ops/sec)"].tolist(),
+                marker="o",
+                label=key_type,
+            )
+        plt.ylabel("Speed (million ops/sec)")
+        plt.xlabel(WORKLOAD_XLABELS.get(scenario, "Parameter"))
+        plt.legend()
+        plt.savefig(f"{plot_dir}/{scenario}.svg", format="svg", dpi=100)
+        md.append("+ %s\n\t![%s](%s)" % (scenario, scenario, f"{plot_dir}/{scenario}.svg"))
+    if GEN_MD:
+        print("\n".join(md))
+
+
+def scaling_plots(csvfile):
+    """plot the output of bf_scaling: throughput by number of threads"""
+    FIGSIZE = (15.63, 9.00)
+    df = pd.read_csv(csvfile)
+    plot_dir = os.path.join("plots", "scaling")
+    if not os.path.exists(plot_dir):
+        os.makedirs(plot_dir)
+    md = []
+    for metric, figname in [
+        ("aggregate speed (million ops/sec)", "aggregate"),
+        ("scaling efficiency", "efficiency"),
+    ]:
+        plt.figure(figsize=FIGSIZE, dpi=MYDPI)
+        for (engine, workload), ddf in df.groupby(["engine", "workload"]):
+            plt.plot(
+                ddf["threads"].tolist(),
+                ddf[metric].tolist(),
+                marker="o",
+                label=f"{engine} / {workload}",
+            )
+        plt.ylabel(metric[0].upper() + metric[1:])
+        plt.xlabel("Number of Threads")
+        plt.legend()
+        plt.savefig(f"{plot_dir}/{figname}.svg", format="svg", dpi=100)
+        md.append("+ %s\n\t![%s](%s)" % (metric, figname, f"{plot_dir}/{figname}.svg"))
+    if GEN_MD:
+        print("\n".join(md))
+
+
 if __name__ == "__main__":
+    import sys
     import warnings
 
     warnings.simplefilter("ignore")
+    if len(sys.argv) > 2 and sys.argv[1] in ("workloads", "scaling"):
+        plots = workload_plots if sys.argv[1] == "workloads" else scaling_plots
+        for csvfile in sys.argv[2:]:
+            plots(csvfile)
+        sys.exit(0)
+
     res_filenames = [
         "./raw_results/benchmark_results_64u.csv",
         "./raw_results/benchmark_results_32u.csv",
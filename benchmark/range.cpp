@@ -0,0 +1,107 @@
+// False positive rate and cost of range lookups of RangeBloomFilter.
+//
+// N keys are drawn uniformly from [0, N * GAP), so that neighboring keys are
+// about GAP apart, and added to a RangeBloomFilter. For range lengths of 1
+// (point lookups with contains()) to 2^16, random ranges which hold no key
+// are looked up to measure the false positive rate, and ranges around a
+// random key to measure the cost of a positive answer. Results are written
+// as CSV.
+//
+//   bf_range [-n ENTRIES] [-e ERROR] [-l LEVELS] [-g GAP] [-q QUERIES]
+//            [-o OUTPUT]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "RangeBloomFilter.h"
+#include "timing.h"
+
+using namespace std;
+
+const char *RESULT_HEADER =
+    "range length,levels,bits per key,false positive rate,empty lookup "
+    "(ns),non-empty lookup (ns)";
+const char *RESULT_FMT = "%lu,%u,%.2f,%.6f,%.1f,%.1f\n";
+
+int main(int argc, char **argv) {
+  size_t entries = 1000 * 1000, queries = 100 * 1000;
+  double error = 0.01;
+  unsigned levels = 16;
+  uint64_t gap = 1u << 20u;
+  const char *filename = "range_results.csv";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-n"))
+      entries = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-e"))
+      error = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-l"))
+      levels = (unsigned) atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-g"))
+      gap = (uint64_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-q"))
+      queries = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-o"))
+      filename = argv[i + 1];
+  }
+
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to create file %s\n", filename);
+    exit(1);
+  }
+  fprintf(fp, "%s\n", RESULT_HEADER);
+  fprintf(stdout, "%s\n", RESULT_HEADER);
+
+  mt19937_64 rng(42);
+  uniform_int_distribution<uint64_t> any_key(0, entries * gap - 1);
+  vector<uint64_t> keys(entries);
+  for (uint64_t &key : keys) key = any_key(rng);
+  sort(keys.begin(), keys.end());
+  RangeBloomFilter bf(entries, error, levels);
+  bf.add_many(keys.data(), keys.size());
+  double bits_per_key = bf.byte_size() * 8.0 / entries;
+
+  for (uint64_t len = 1; len <= (1u << 16u); len *= 4) {
+    // starts of [lo, lo + len - 1] ranges without and with a key
+    vector<uint64_t> empty, full;
+    uniform_int_distribution<size_t> any_index(0, entries - 1);
+    uniform_int_distribution<uint64_t> any_offset(0, len - 1);
+    while (empty.size() < queries) {
+      uint64_t lo = any_key(rng);
+      auto next = lower_bound(keys.begin(), keys.end(), lo);
+      if (next == keys.end() || *next > lo + len - 1) empty.push_back(lo);
+    }
+    while (full.size() < queries) {
+      uint64_t key = keys[any_index(rng)], offset = any_offset(rng);
+      full.push_back(key >= offset ? key - offset : 0);
+    }
+
+    size_t positives = 0;
+    uint64_t start = NowNanos();
+    for (uint64_t lo : empty) {
+      positives += len == 1 ? bf.contains(lo)
+                            : bf.may_contain_range(lo, lo + len - 1);
+    }
+    double empty_ns = (double) (NowNanos() - start) / queries;
+    size_t found = 0;
+    start = NowNanos();
+    for (uint64_t lo : full) {
+      found += len == 1 ? bf.contains(lo)
+                        : bf.may_contain_range(lo, lo + len - 1);
+    }
+    double full_ns = (double) (NowNanos() - start) / queries;
+    if (found != queries) {
+      fprintf(stderr, "False negative!\n");
+      exit(1);
+    }
+    for (FILE *out : {fp, stdout}) {
+      fprintf(out, RESULT_FMT, (unsigned long) len, levels, bits_per_key,
+              (double) positives / queries, empty_ns, full_ns);
+    }
+  }
+  fclose(fp);
+}
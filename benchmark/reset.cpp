@@ -0,0 +1,108 @@
+// Init and reset latency of filters of growing size, per allocation (see
+// enum bloom_alloc).
+//
+// For bitmaps of 1 MiB up to the given size (doubling), a filter is
+// initialized with bloom_init_alloc(), every page of it is dirtied, it is
+// reset with bloom_reset() and dirtied again. Reported, in milliseconds:
+//
+//   init         - bloom_init_alloc()
+//   first touch  - writing every page after init (page faults, zeroing)
+//   reset        - bloom_reset() of the dirty filter
+//   retouch      - writing every page after the reset
+//
+// init + first touch is what a fresh filter costs before it runs at full
+// speed; reset + retouch what reusing it costs. Results are written as CSV.
+//
+//   bf_reset [-s MAX_MIB] [-r ROUNDS] [-o OUTPUT]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "bloom.h"
+#include "timing.h"
+
+using namespace std;
+
+const char *RESULT_HEADER =
+    "alloc,bytes,init (ms),first touch (ms),reset (ms),retouch (ms)";
+const char *RESULT_FMT = "%s,%lu,%.3f,%.3f,%.3f,%.3f\n";
+
+struct Alloc {
+  const char *name;
+  int alloc;
+};
+const vector<Alloc> ALLOCS({{"heap", BLOOM_ALLOC_HEAP},
+                            {"mmap", BLOOM_ALLOC_MMAP},
+                            {"huge", BLOOM_ALLOC_HUGE}});
+
+// bits per entry at an error of 1%
+const double BITS_PER_ENTRY = 9.585;
+
+/** Write one byte of every 4 KiB page of the bitmap. */
+static void touch(struct bloom *bf) {
+  for (size_t i = 0; i < bf->bytes; i += 4096) bf->bf[i] = 0xff;
+}
+
+static double millis(uint64_t start) {
+  return (NowNanos() - start) / 1e6;
+}
+
+int main(int argc, char **argv) {
+  size_t max_mib = 1024, rounds = 3;
+  const char *filename = "reset_results.csv";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-s"))
+      max_mib = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-r"))
+      rounds = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-o"))
+      filename = argv[i + 1];
+  }
+
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to create file %s\n", filename);
+    exit(1);
+  }
+  fprintf(fp, "%s\n", RESULT_HEADER);
+  fprintf(stdout, "%s\n", RESULT_HEADER);
+
+  for (size_t mib = 1; mib <= max_mib; mib *= 2) {
+    size_t entries = (size_t) (mib * 8.0 * 1024 * 1024 / BITS_PER_ENTRY);
+    for (const Alloc &a : ALLOCS) {
+      // best of `rounds`
+      double init = 1e300, first = 1e300, reset = 1e300, retouch = 1e300;
+      size_t bytes = 0;
+      for (size_t r = 0; r < rounds; ++r) {
+        struct bloom bf;
+        uint64_t start = NowNanos();
+        if (bloom_init_alloc(&bf, entries, 0.01, BLOOM_SIZING_OPTIMAL,
+                             a.alloc) != 0) {
+          fprintf(stderr, "Failed to allocate %lu MiB (%s)\n",
+                  (unsigned long) mib, a.name);
+          exit(1);
+        }
+        init = min(init, millis(start));
+        start = NowNanos();
+        touch(&bf);
+        first = min(first, millis(start));
+        start = NowNanos();
+        bloom_reset(&bf);
+        reset = min(reset, millis(start));
+        start = NowNanos();
+        touch(&bf);
+        retouch = min(retouch, millis(start));
+        bytes = bf.bytes;
+        bloom_free(&bf);
+      }
+      for (FILE *out : {fp, stdout}) {
+        fprintf(out, RESULT_FMT, a.name, (unsigned long) bytes, init, first,
+                reset, retouch);
+      }
+    }
+  }
+  fclose(fp);
+}
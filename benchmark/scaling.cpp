@@ -0,0 +1,151 @@
+// Multi-threaded throughput of a single filter shared by N threads, each
+// pinned to its own core, for N = 1, 2, 4, ... up to all cores.
+//
+// Workloads: read-only (contains), write-only (add) and mixed (90% reads,
+// 10% writes). Engines:
+//
+//   classic - lock-free readers, writers serialized by a mutex (add() must
+//             not run concurrently with other writers)
+//   atomic  - lock-free readers and writers through add_atomic()
+//
+// Results are written as CSV, plot them with `plots.py scaling FILE`.
+//
+//   bf_scaling [-n MILLION_ITEMS] [-e ERROR] [-t MAX_THREADS] [-o OUTPUT]
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "BloomFilter.h"
+#include "random.h"
+#include "timing.h"
+
+using namespace std;
+
+const size_t ONE_MILLION = 1000 * 1000;
+const size_t OPS_PER_THREAD = 2 * ONE_MILLION;
+const char *RESULT_HEADER =
+    "engine,workload,threads,filter bytes,aggregate speed (million "
+    "ops/sec),per-thread speed (million ops/sec),scaling efficiency";
+const char *RESULT_FMT = "%s,%s,%u,%lu,%.8f,%.8f,%.4f\n";
+
+enum Engine { CLASSIC, ATOMIC };
+const char *ENGINE_NAMES[] = {"classic", "atomic"};
+
+struct Workload {
+  const char *name;
+  double write_fraction;
+};
+const vector<Workload> WORKLOADS(
+    {{"read-only", 0.0}, {"write-only", 1.0}, {"mixed", 0.1}});
+
+static void pin_to_core(unsigned core) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core % thread::hardware_concurrency(), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/** Aggregate throughput (million ops/sec) of `threads` threads. */
+static double run(BloomFilter &bf, Engine engine, const Workload &workload,
+                  unsigned threads, const vector<uint64_t> &keys) {
+  mutex write_lock;
+  atomic<unsigned> ready(0);
+  atomic<bool> go(false);
+  vector<thread> workers;
+  vector<size_t> found(threads);
+
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      pin_to_core(t);
+      // each thread walks its own slice of the key pool
+      size_t offset = (keys.size() / threads) * t;
+      mt19937_64 rng(t);
+      bernoulli_distribution is_write(workload.write_fraction);
+      vector<char> writes(OPS_PER_THREAD);
+      for (auto &w : writes) w = is_write(rng);
+
+      ready++;
+      while (!go.load(memory_order_acquire)) this_thread::yield();
+      size_t hits = 0;
+      for (size_t i = 0; i < OPS_PER_THREAD; ++i) {
+        uint64_t key = keys[(offset + i) % keys.size()];
+        if (!writes[i]) {
+          hits += bf.contains(key);
+        } else if (engine == ATOMIC) {
+          bf.add_atomic(key);
+        } else {
+          lock_guard<mutex> guard(write_lock);
+          bf.add(key);
+        }
+      }
+      found[t] = hits;
+    });
+  }
+
+  while (ready.load() < threads) this_thread::yield();
+  uint64_t start_time = NowNanos();
+  go.store(true, memory_order_release);
+  for (auto &w : workers) w.join();
+  uint64_t time = NowNanos() - start_time;
+
+  return (double) OPS_PER_THREAD * threads / (time / 1e9) / ONE_MILLION;
+}
+
+int main(int argc, char **argv) {
+  double millions = 10;
+  double error = 0.01;
+  unsigned max_threads = thread::hardware_concurrency();
+  const char *filename = "scaling_results.csv";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-n"))
+      millions = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-e"))
+      error = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-t"))
+      max_threads = (unsigned) atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-o"))
+      filename = argv[i + 1];
+  }
+  size_t add_count = (size_t) (millions * ONE_MILLION);
+
+  vector<unsigned> thread_counts;
+  for (unsigned t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+  thread_counts.push_back(max(1u, max_threads));
+
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to create file %s\n", filename);
+    exit(1);
+  }
+  fprintf(fp, "%s\n", RESULT_HEADER);
+  fprintf(stdout, "%s\n", RESULT_HEADER);
+
+  // half of the keys are inserted up front, lookups hit about 50% of the time
+  vector<uint64_t> keys = GenerateRandom64(add_count);
+  for (Engine engine : {CLASSIC, ATOMIC}) {
+    for (const auto &workload : WORKLOADS) {
+      double single = 0;
+      for (unsigned threads : thread_counts) {
+        BloomFilter bf(add_count, error);
+        bf.add_many(keys.data(), keys.size() / 2);
+        double speed = run(bf, engine, workload, threads, keys);
+        if (threads == 1) single = speed;
+        for (FILE *out : {fp, stdout}) {
+          fprintf(out, RESULT_FMT, ENGINE_NAMES[engine], workload.name,
+                  threads, (unsigned long) bf.byte_size(), speed,
+                  speed / threads, speed / (threads * single));
+        }
+      }
+    }
+  }
+  fclose(fp);
+}
@@ -0,0 +1,108 @@
+// Lookup cost of a TieredBloomFilter against its large filter alone, for
+// mixes of mostly negative lookups.
+//
+// KEYS random keys are added to a TieredBloomFilter whose large filter is
+// sized for CAPACITY items at 1% (larger than the caches), behind a summary
+// of SUMMARY_KIB (half the L2 cache by default). Lookups of QUERIES keys, of
+// which 50% to 100% are negatives, are timed through the summary
+// (contains()) and on a BloomFilter of the same shape alone; the average
+// time per lookup in nanoseconds is reported as CSV.
+//
+//   bf_tiered [-n KEYS] [-c CAPACITY] [-s SUMMARY_KIB] [-q QUERIES]
+//             [-o OUTPUT]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "TieredBloomFilter.h"
+#include "random.h"
+#include "timing.h"
+
+using namespace std;
+
+const char *RESULT_HEADER =
+    "negatives,filter bytes,summary bytes,summary fpp,combined fpp,filter "
+    "lookup (ns),tiered lookup (ns)";
+const char *RESULT_FMT = "%.2f,%lu,%lu,%.6f,%.3g,%.1f,%.1f\n";
+
+int main(int argc, char **argv) {
+  size_t keys = 1000 * 1000, capacity = 1000 * 1000 * 1000;
+  size_t summary_kib = 0, queries = 1000 * 1000;
+  const char *filename = "tiered_results.csv";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-n"))
+      keys = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-c"))
+      capacity = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-s"))
+      summary_kib = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-q"))
+      queries = (size_t) atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-o"))
+      filename = argv[i + 1];
+  }
+
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to create file %s\n", filename);
+    exit(1);
+  }
+  fprintf(fp, "%s\n", RESULT_HEADER);
+  fprintf(stdout, "%s\n", RESULT_HEADER);
+
+  vector<uint64_t> members = GenerateRandom64(keys);
+  const double mixes[] = {0.5, 0.9, 0.99, 1.0};
+  vector<vector<uint64_t>> lookups;
+  mt19937_64 rng(42);
+  for (double negatives : mixes) {
+    // random 64-bit keys are negatives but for a 2^-64 chance
+    lookups.push_back(GenerateRandom64(queries));
+    uniform_int_distribution<size_t> any_member(0, keys - 1);
+    for (size_t i = 0; i < (size_t) (queries * (1.0 - negatives)); ++i) {
+      lookups.back()[i] = members[any_member(rng)];
+    }
+    shuffle(lookups.back().begin(), lookups.back().end(), rng);
+  }
+
+  // the large filter alone: a BloomFilter of the same shape and seed, freed
+  // before the tiered filter is built so that only one is in memory
+  vector<size_t> found;
+  vector<double> filter_ns;
+  size_t filter_bytes;
+  {
+    BloomFilter bf(capacity, 0.01, BLOOM_ALLOC_HEAP);
+    for (uint64_t key : members) bf.add(key);
+    filter_bytes = bf.byte_size();
+    for (const vector<uint64_t> &mix : lookups) {
+      size_t hits = 0;
+      uint64_t start = NowNanos();
+      for (uint64_t key : mix) hits += bf.contains(key);
+      filter_ns.push_back((double) (NowNanos() - start) / queries);
+      found.push_back(hits);
+    }
+  }
+
+  TieredBloomFilter bf(capacity, 0.01, summary_kib * 1024);
+  for (uint64_t key : members) bf.add(key);
+  double summary_fpp = bf.summary_fpp(), combined_fpp = bf.effective_fpp();
+  for (size_t m = 0; m < lookups.size(); ++m) {
+    size_t tiered_found = 0;
+    uint64_t start = NowNanos();
+    for (uint64_t key : lookups[m]) tiered_found += bf.contains(key);
+    double tiered_ns = (double) (NowNanos() - start) / queries;
+    if (tiered_found > found[m]) {
+      fprintf(stderr, "Summary positive missing from the filter!\n");
+      exit(1);
+    }
+    for (FILE *out : {fp, stdout}) {
+      fprintf(out, RESULT_FMT, mixes[m], (unsigned long) filter_bytes,
+              (unsigned long) bf.summary().byte_size(), summary_fpp,
+              combined_fpp, filter_ns[m], tiered_ns);
+    }
+  }
+  fclose(fp);
+}
@@ -0,0 +1,331 @@
+// Workload benchmarks closer to a production mix than the pure-negative
+// lookups of benchmarks.cpp:
+//
+//   positive   - lookups in which a given fraction (0..100%) of the keys is
+//                present (generated with MixIn())
+//   zipf       - lookups of Zipf-skewed, repeated keys
+//   interleave - a single stream of interleaved inserts and lookups
+//
+// for u64 keys and for realistic string keys (URLs, UUIDs, or the lines of a
+// local file given with -k). Results are written as CSV, plot them with
+// `plots.py workloads FILE`.
+//
+//   bf_workloads [-n MILLION_ITEMS] [-e ERROR] [-k KEY_FILE] [-o OUTPUT]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BloomFilter.h"
+#include "random.h"
+#include "timing.h"
+
+using namespace std;
+
+const size_t ONE_MILLION = 1000 * 1000;
+const size_t LOOKUP_COUNT = ONE_MILLION;
+const char *RESULT_HEADER =
+    "scenario,key type,parameter,# of items (million),desired fpr,positive "
+    "ratio,false positive rate,speed (million ops/sec)";
+const char *RESULT_FMT = "%s,%s,%.4f,%.4f,%.8f%%,%.4f,%.8f%%,%.8f\n";
+
+const vector<double> POSITIVE_FRACTIONS(
+    {0.0, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1.0});
+const vector<double> ZIPF_SKEWS({0.0, 0.5, 0.8, 0.99, 1.2});
+const vector<double> WRITE_FRACTIONS({0.01, 0.1, 0.5});
+
+struct Result {
+  double positive_ratio;  // fraction of lookups of present keys
+  double fpr;             // false positive rate (%)
+  double speed;           // million ops/sec
+};
+
+/** Keys to insert and keys which are never inserted. */
+template <typename T>
+struct KeySet {
+  string name;
+  vector<T> present;
+  vector<T> absent;
+};
+
+static mt19937_64 &rng() {
+  static mt19937_64 g(0x9747b28c);
+  return g;
+}
+
+static string random_hex(size_t len) {
+  static const char *HEX = "0123456789abcdef";
+  string s(len, '0');
+  for (auto &c : s) c = HEX[rng()() & 0xf];
+  return s;
+}
+
+static string random_uuid() {
+  string s = random_hex(32);
+  s[12] = '4';
+  s[16] = "89ab"[rng()() & 0x3];
+  return s.substr(0, 8) + "-" + s.substr(8, 4) + "-" + s.substr(12, 4) + "-" +
+         s.substr(16, 4) + "-" + s.substr(20, 12);
+}
+
+static string random_url() {
+  static const char *HOSTS[] = {"www", "api", "cdn", "img", "static", "m"};
+  static const char *WORDS[] = {"products", "users", "search", "item",
+                                "category", "news",  "2020",   "assets",
+                                "view",     "list",  "detail", "en-us"};
+  string url = string("https://") + HOSTS[rng()() % 6] + "." +
+               random_hex(6) + ".example.com";
+  for (int depth = 1 + rng()() % 4; depth > 0; --depth) {
+    url += "/";
+    url += WORDS[rng()() % 12];
+  }
+  return url + "/" + to_string(rng()() % 10000000) + "?ref=" + random_hex(8);
+}
+
+template <typename T>
+static void split(KeySet<T> &keys, vector<T> all, size_t add_count) {
+  remove_duplications(all, rng());
+  add_count = min(add_count, all.size() / 2);
+  keys.present.assign(all.begin(), all.begin() + add_count);
+  keys.absent.assign(all.begin() + add_count, all.end());
+}
+
+static KeySet<uint64_t> u64_keys(size_t add_count) {
+  KeySet<uint64_t> keys{"uint64_t", {}, {}};
+  split(keys, GenerateRandom64(add_count + LOOKUP_COUNT + add_count / 10),
+        add_count);
+  return keys;
+}
+
+template <typename Gen>
+static KeySet<string> generated_keys(const char *name, size_t add_count,
+                                     Gen gen) {
+  KeySet<string> keys{name, {}, {}};
+  vector<string> all(add_count + LOOKUP_COUNT + add_count / 10);
+  for (auto &key : all) key = gen();
+  split(keys, move(all), add_count);
+  return keys;
+}
+
+static KeySet<string> file_keys(const char *filename, size_t add_count) {
+  KeySet<string> keys{"file", {}, {}};
+  ifstream in(filename);
+  if (!in) {
+    fprintf(stderr, "Failed to open key file %s\n", filename);
+    exit(1);
+  }
+  vector<string> all;
+  for (string line; getline(in, line);) {
+    if (!line.empty()) all.push_back(line);
+  }
+  // the first half of the (distinct) lines is inserted
+  split(keys, move(all), add_count);
+  return keys;
+}
+
+/** Ranks drawn from a Zipf distribution over [0, n) with exponent `s`. */
+static vector<size_t> zipf_ranks(size_t n, double s, size_t count) {
+  vector<double> cdf(n);
+  double sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    sum += 1.0 / pow((double) (i + 1), s);
+    cdf[i] = sum;
+  }
+  uniform_real_distribution<double> u(0, sum);
+  vector<size_t> ranks(count);
+  for (auto &r : ranks) {
+    r = upper_bound(cdf.begin(), cdf.end(), u(rng())) - cdf.begin();
+    if (r >= n) r = n - 1;
+  }
+  return ranks;
+}
+
+template <typename T>
+static BloomFilter build(const KeySet<T> &keys, double error) {
+  BloomFilter bf(keys.present.size(), error);
+  for (const auto &key : keys.present) bf.add(key);
+  return bf;
+}
+
+/** Time the lookups of `stream`, `present[i]` tells whether stream[i] was
+ * inserted. */
+template <typename T>
+static Result run_lookups(BloomFilter &bf, const vector<T> &stream,
+                          const vector<char> &present) {
+  size_t found = 0;
+  for (size_t i = 0; i < stream.size() / 10; ++i) {
+    found += bf.contains(stream[i]);  // warm-up
+  }
+
+  found = 0;
+  size_t false_positives = 0, positives = 0;
+  uint64_t start_time = NowNanos();
+  for (const auto &key : stream) found += bf.contains(key);
+  uint64_t check_time = NowNanos() - start_time;
+
+  for (size_t i = 0; i < stream.size(); ++i) {
+    positives += present[i];
+    if (!present[i]) false_positives += bf.contains(stream[i]);
+  }
+  Result res;
+  res.positive_ratio = (double) positives / stream.size();
+  res.fpr =
+      100.0 * false_positives / max<size_t>(1, stream.size() - positives);
+  res.speed = stream.size() / (check_time / 1e9) / ONE_MILLION;
+  if (found < positives) {
+    fprintf(stderr, "error: false negatives in lookups!\n");
+    exit(1);
+  }
+  return res;
+}
+
+template <typename T>
+static Result positive_fraction(const KeySet<T> &keys, double error,
+                                double fraction) {
+  BloomFilter bf = build(keys, error);
+  size_t n = min(LOOKUP_COUNT, keys.absent.size());
+  vector<T> stream = MixIn(&keys.absent[0], &keys.absent[0] + n,
+                           &keys.present[0],
+                           &keys.present[0] + keys.present.size(), fraction);
+  // MixIn() shuffles, so membership is re-derived from the absent keys
+  vector<T> absent(keys.absent.begin(), keys.absent.begin() + n);
+  sort(absent.begin(), absent.end());
+  vector<char> present(stream.size());
+  for (size_t i = 0; i < stream.size(); ++i) {
+    present[i] = !binary_search(absent.begin(), absent.end(), stream[i]);
+  }
+  return run_lookups(bf, stream, present);
+}
+
+template <typename T>
+static Result zipf(const KeySet<T> &keys, double error, double skew) {
+  BloomFilter bf = build(keys, error);
+  // half of the universe is present, hot keys are scattered over both halves
+  size_t half = min(keys.present.size(), keys.absent.size());
+  vector<pair<const T *, char>> universe;
+  for (size_t i = 0; i < half; ++i) {
+    universe.emplace_back(&keys.present[i], 1);
+    universe.emplace_back(&keys.absent[i], 0);
+  }
+  shuffle(universe.begin(), universe.end(), rng());
+
+  vector<T> stream;
+  vector<char> present;
+  for (size_t r : zipf_ranks(universe.size(), skew, LOOKUP_COUNT)) {
+    stream.push_back(*universe[r].first);
+    present.push_back(universe[r].second);
+  }
+  return run_lookups(bf, stream, present);
+}
+
+/** Interleaved inserts (of absent keys) and lookups (of present keys and
+ * of absent keys never inserted). */
+template <typename T>
+static Result interleave(const KeySet<T> &keys, double error,
+                         double write_fraction) {
+  enum { WRITE, HIT, MISS };
+  // the filter is sized for everything that gets inserted
+  size_t inserts = (size_t) (LOOKUP_COUNT * write_fraction);
+  inserts = min(inserts, keys.absent.size() / 2);
+  BloomFilter bf(keys.present.size() + inserts, error);
+  for (const auto &key : keys.present) bf.add(key);
+
+  bernoulli_distribution is_write(write_fraction), is_hit(0.5);
+  vector<const T *> ops(LOOKUP_COUNT);
+  vector<char> kinds(LOOKUP_COUNT);
+  size_t next_insert = 0, next_miss = inserts;
+  for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+    if (next_insert < inserts && is_write(rng())) {
+      kinds[i] = WRITE;
+      ops[i] = &keys.absent[next_insert++];
+    } else if (is_hit(rng()) || next_miss >= keys.absent.size()) {
+      kinds[i] = HIT;
+      ops[i] = &keys.present[rng()() % keys.present.size()];
+    } else {
+      kinds[i] = MISS;
+      ops[i] = &keys.absent[next_miss++];
+    }
+  }
+
+  size_t found = 0;
+  uint64_t start_time = NowNanos();
+  for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+    if (kinds[i] == WRITE)
+      bf.add(*ops[i]);
+    else
+      found += bf.contains(*ops[i]);
+  }
+  uint64_t time = NowNanos() - start_time;
+
+  size_t hits = 0, misses = 0, false_positives = 0;
+  for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+    if (kinds[i] == HIT) hits++;
+    if (kinds[i] == MISS) {
+      misses++;
+      false_positives += bf.contains(*ops[i]);
+    }
+  }
+  if (found < hits) {
+    fprintf(stderr, "error: false negatives in lookups!\n");
+    exit(1);
+  }
+  Result res;
+  res.positive_ratio = (double) hits / max<size_t>(1, hits + misses);
+  res.fpr = 100.0 * false_positives / max<size_t>(1, misses);
+  res.speed = LOOKUP_COUNT / (time / 1e9) / ONE_MILLION;
+  return res;
+}
+
+template <typename T>
+static void run_all(const KeySet<T> &keys, double error, FILE *fp) {
+  auto report = [&](const char *scenario, double param, const Result &res) {
+    for (FILE *out : {fp, stdout}) {
+      fprintf(out, RESULT_FMT, scenario, keys.name.c_str(), param,
+              (double) keys.present.size() / ONE_MILLION, error * 100,
+              res.positive_ratio, res.fpr, res.speed);
+    }
+  };
+  for (double fraction : POSITIVE_FRACTIONS)
+    report("positive", fraction, positive_fraction(keys, error, fraction));
+  for (double skew : ZIPF_SKEWS) report("zipf", skew, zipf(keys, error, skew));
+  for (double wf : WRITE_FRACTIONS)
+    report("interleave", wf, interleave(keys, error, wf));
+}
+
+int main(int argc, char **argv) {
+  double millions = 1;
+  double error = 0.01;
+  const char *key_file = nullptr;
+  const char *filename = "workload_results.csv";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-n"))
+      millions = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-e"))
+      error = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-k"))
+      key_file = argv[i + 1];
+    else if (!strcmp(argv[i], "-o"))
+      filename = argv[i + 1];
+  }
+  size_t add_count = (size_t) (millions * ONE_MILLION);
+
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to create file %s\n", filename);
+    exit(1);
+  }
+  fprintf(fp, "%s\n", RESULT_HEADER);
+  fprintf(stdout, "%s\n", RESULT_HEADER);
+
+  run_all(u64_keys(add_count), error, fp);
+  run_all(generated_keys("url", add_count, random_url), error, fp);
+  run_all(generated_keys("uuid", add_count, random_uuid), error, fp);
+  if (key_file != nullptr) run_all(file_keys(key_file, add_count), error, fp);
+
+  fclose(fp);
+}
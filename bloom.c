@@ -9,35 +9,135 @@
  * Refer to bloom.h for documentation on the public interfaces.
  */
 
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS and madvise() under -std=c99
+#endif
+
 #include <assert.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <math.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "bloom.h"
+#include "bloom_probes.h"
+
+#include "murmurhash2.h"
+#include <wyhash.h>
 
-#ifndef HASH_FN
-#if defined(USE_XXHASH)
+#if defined(__has_include)
+#if __has_include(<xxhash.h>)
+#define XXH_INLINE_ALL
 #include <xxhash.h>
-#define HASH_FN(key, len, seed) XXH64(key, len, seed)
+#define BLOOM_HAVE_XXH3 1
+#endif
+#endif
+
+// Hash of new filters, see bloom_set_hash() to choose another one.
+#if defined(USE_XXHASH) && defined(BLOOM_HAVE_XXH3)
+#define BLOOM_HASH_DEFAULT BLOOM_HASH_XXH3
 #elif defined(USE_WYHASH)
-#include <wyhash.h>
-#define HASH_FN(key, len, seed) wyhash(key, len, seed, _wyp)
+#define BLOOM_HASH_DEFAULT BLOOM_HASH_WYHASH
 #else
-#include "murmurhash2.h"
-#define HASH_FN(key, len, seed) murmurhash2(key, len, seed)
+#define BLOOM_HASH_DEFAULT BLOOM_HASH_MURMUR2
 #endif
+
+static uint64_t hash_murmur2(const void *key, int len, uint64_t seed) {
+  return murmurhash2(key, len, (unsigned int) seed);
+}
+
+static uint64_t hash_wyhash(const void *key, int len, uint64_t seed) {
+  return wyhash(key, (uint64_t) len, seed, _wyp);
+}
+
+#ifdef BLOOM_HAVE_XXH3
+static uint64_t hash_xxh3(const void *key, int len, uint64_t seed) {
+  return XXH3_64bits_withSeed(key, (size_t) len, seed);
+}
 #endif
 
+// Indexed by enum bloom_hash; NULL if not compiled in.
+static const struct {
+  const char *name;
+  bloom_hash_fn fn;
+} hash_table[BLOOM_HASH_COUNT] = {
+    {"murmur2", hash_murmur2},
+    {"wyhash", hash_wyhash},
+#ifdef BLOOM_HAVE_XXH3
+    {"xxh3", hash_xxh3},
+#else
+    {"xxh3", NULL},
+#endif
+};
+
+#define HASH_FN(bloom, key, len, seed) (bloom)->hash_fn(key, len, seed)
+
+// Bit probed by the i-th hash: a mask instead of a division for filters
+// sized to a power of two (the branch is the same for every probe).
+#define BIT_INDEX(bloom, a, b, i)                                          \
+  ((bloom)->mask ? ((a) + (i) * (b)) & (bloom)->mask                       \
+                 : ((a) + (i) * (b)) % (bloom)->bits)
+
 #define MAKESTRING(n) STRING(n)
 #define STRING(n) #n
 
+struct bloom_stats_shard {
+  uint64_t adds;
+  uint64_t lookups;
+  uint64_t positives;
+  uint64_t probes;
+  uint64_t probe_depth[BLOOM_STATS_PROBE_BUCKETS];
+  // one shard per 64-byte cache line(s), so threads do not share lines
+  unsigned char pad[64 - (4 + BLOOM_STATS_PROBE_BUCKETS) * 8 % 64];
+};
+
+struct bloom_stats {
+  void *mem; // unaligned allocation, for free()
+  unsigned char pad[64 - sizeof(void *)];
+  struct bloom_stats_shard shard[BLOOM_STATS_SHARDS];
+};
+
+static __thread int stats_shard_id = -1;
+static unsigned int stats_next_shard = 0;
+
+inline static struct bloom_stats_shard *stats_shard(struct bloom_stats *s) {
+  if (stats_shard_id < 0) {
+    stats_shard_id = (int) (__atomic_fetch_add(&stats_next_shard, 1,
+                                               __ATOMIC_RELAXED) %
+                            BLOOM_STATS_SHARDS);
+  }
+  return &s->shard[stats_shard_id];
+}
+
+inline static void stats_count(uint64_t *counter, uint64_t n) {
+  __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+inline static void stats_add(struct bloom_stats *s) {
+  stats_count(&stats_shard(s)->adds, 1);
+}
+
+inline static void stats_lookup(struct bloom_stats *s, unsigned int depth,
+                                int found) {
+  struct bloom_stats_shard *shard = stats_shard(s);
+  unsigned int bucket = depth < BLOOM_STATS_PROBE_BUCKETS
+                            ? depth - 1
+                            : BLOOM_STATS_PROBE_BUCKETS - 1;
+  stats_count(&shard->lookups, 1);
+  stats_count(&shard->probes, depth);
+  stats_count(&shard->probe_depth[bucket], 1);
+  if (found) stats_count(&shard->positives, 1);
+}
+
 inline static int test_bit_set_bit(unsigned char *buf, size_t x,
                                    int set_bit) {
   size_t byte = (size_t) x >> 3u;
@@ -71,6 +171,14 @@ inline static void set_bit(unsigned char *buf, size_t x) {
   buf[byte] |= mask;
 }
 
+inline static void set_bit_atomic(unsigned char *buf, size_t x) {
+  size_t byte = x >> 3u;
+  unsigned char mask = (unsigned char) (1u << (x & 0x7lu));
+  if (!(__atomic_load_n(&buf[byte], __ATOMIC_RELAXED) & mask)) {
+    __atomic_fetch_or(&buf[byte], mask, __ATOMIC_RELAXED);
+  }
+}
+
 static int bloom_check_add(struct bloom *bloom, const void *buffer, int len,
                            int add) {
   if (bloom->ready == 0) {
@@ -79,20 +187,27 @@ static int bloom_check_add(struct bloom *bloom, const void *buffer, int len,
   }
 
   int hits = 0;
-  register size_t a = HASH_FN(buffer, len, bloom->hashSeed);
-  register size_t b = HASH_FN(buffer, len, a);
+  register size_t a = HASH_FN(bloom, buffer, len, bloom->hashSeed);
+  register size_t b = HASH_FN(bloom, buffer, len, a);
   register size_t x;
   register unsigned int i;
 
   for (i = 0; i < bloom->hashes; i++) {
-    x = (a + i * b) % bloom->bits;
+    x = BIT_INDEX(bloom, a, b, i);
     if (test_bit_set_bit(bloom->bf, x, add)) {
       hits++;
     } else if (!add) {
       // Don't care about the presence of all the bits. Just our own.
+      if (bloom->stats) stats_lookup(bloom->stats, i + 1, 0);
       return 0;
     }
   }
+  if (bloom->stats) {
+    if (add)
+      stats_add(bloom->stats);
+    else
+      stats_lookup(bloom->stats, bloom->hashes, 1);
+  }
 #ifdef COUNTING_SET_BITS_ON
   if (add)
     bloom.num_set_bits += bloom->hashes - hits;
@@ -113,6 +228,12 @@ int bloom_init_size(struct bloom *bloom, size_t entries, double error,
 // added by Long
 void bloom_init_wo_allocation(struct bloom *bloom, size_t entries,
                               double error) {
+  bloom_init_wo_allocation_sizing(bloom, entries, error,
+                                  BLOOM_SIZING_OPTIMAL);
+}
+
+void bloom_init_wo_allocation_sizing(struct bloom *bloom, size_t entries,
+                                     double error, int sizing) {
   bloom->entries = entries;
   bloom->error = error;
 
@@ -122,6 +243,13 @@ void bloom_init_wo_allocation(struct bloom *bloom, size_t entries,
 
   double dentries = (double) entries;
   bloom->bits = (size_t) ceil(dentries * bloom->bpe);
+  bloom->mask = 0;
+  if (sizing == BLOOM_SIZING_POW2) {
+    size_t bits = BLOOM_MIN_POW2_BITS;
+    while (bits < bloom->bits) bits <<= 1u;
+    bloom->bits = bits;
+    bloom->mask = bits - 1;
+  }
 
   if (bloom->bits % 8) {
     bloom->bytes = (bloom->bits / 8) + 1;
@@ -132,101 +260,1140 @@ void bloom_init_wo_allocation(struct bloom *bloom, size_t entries,
   bloom->hashes = (int) ceil(0.693147180559945 * bloom->bpe); // ln(2)
 
   bloom->hashSeed = 0x9747b28c;
+  bloom->hash_id = BLOOM_HASH_DEFAULT;
+  bloom->hash_fn = hash_table[BLOOM_HASH_DEFAULT].fn;
+  bloom->alloc = BLOOM_ALLOC_HEAP;
+  bloom->mapped = 0;
+  bloom->stats = NULL;
 #ifdef COUNTING_SET_BITS_ON
   bloom.num_set_bits = 0;
 #endif
 }
 
 int bloom_init(struct bloom *bloom, size_t entries, double error) {
+  return bloom_init_sizing(bloom, entries, error, BLOOM_SIZING_OPTIMAL);
+}
+
+int bloom_init_sizing(struct bloom *bloom, size_t entries, double error,
+                      int sizing) {
+  return bloom_init_alloc(bloom, entries, error, sizing, BLOOM_ALLOC_HEAP);
+}
+
+#define BLOOM_HUGE_PAGE (2u << 20u)
+
+/* Zeroed pages for the bit field: bloom->bytes rounded up to whole pages
+ * (whole 2 MiB pages, 2 MiB aligned, for BLOOM_ALLOC_HUGE). */
+static unsigned char *map_bits(struct bloom *bloom, int alloc) {
+#ifdef MAP_ANONYMOUS
+  size_t page = alloc == BLOOM_ALLOC_HUGE ? BLOOM_HUGE_PAGE
+                                          : (size_t) sysconf(_SC_PAGESIZE);
+  size_t len = (bloom->bytes + page - 1) / page * page;
+  size_t extra = alloc == BLOOM_ALLOC_HUGE ? page : 0;
+  unsigned char *map =
+      (unsigned char *) mmap(NULL, len + extra, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+  if (extra) {
+    // trim to a huge page boundary, so the kernel can back it with huge pages
+    size_t head = (page - (uintptr_t) map % page) % page;
+    if (head) munmap(map, head);
+    if (extra - head) munmap(map + head + len, extra - head);
+    map += head;
+#ifdef MADV_HUGEPAGE
+    madvise(map, len, MADV_HUGEPAGE);
+#endif
+  }
+  bloom->mapped = len;
+  return map;
+#else
+  (void) bloom;
+  (void) alloc;
+  return NULL;
+#endif
+}
+
+int bloom_init_alloc(struct bloom *bloom, size_t entries, double error,
+                     int sizing, int alloc) {
 #ifdef DEBUG
   printf("entries = %lu, error = %.8f\n", entries, error);
 #endif
   bloom->ready = 0;
   if (!(entries > 0 && error > 0 && error < 1.0))
     return 1;
-  bloom_init_wo_allocation(bloom, entries, error);
+  if (sizing != BLOOM_SIZING_OPTIMAL && sizing != BLOOM_SIZING_POW2)
+    return 1;
+  if (alloc < BLOOM_ALLOC_HEAP || alloc > BLOOM_ALLOC_HUGE)
+    return 1;
+  bloom_init_wo_allocation_sizing(bloom, entries, error, sizing);
   // allocating space
-  bloom->bf = (unsigned char *) calloc(bloom->bytes, sizeof(unsigned char));
+  if (alloc == BLOOM_ALLOC_HEAP) {
+    bloom->bf = (unsigned char *) calloc(bloom->bytes, sizeof(unsigned char));
+  } else {
+    bloom->bf = map_bits(bloom, alloc);
+    bloom->alloc = alloc;
+  }
   if (bloom->bf == NULL) { // LCOV_EXCL_START
-    printf("memory allocation failed, while trying to calloc %lu bytes of "
+    printf("memory allocation failed, while trying to %s %lu bytes of "
            "memory!\n",
-           bloom->bytes);
+           alloc == BLOOM_ALLOC_HEAP ? "calloc" : "mmap", bloom->bytes);
+    bloom->alloc = BLOOM_ALLOC_HEAP;
     return 1;
   } // LCOV_EXCL_STOP
 
   bloom->ready = 1;
+  BLOOM_PROBE3(init, bloom, entries, bloom->bytes);
 
   return 0;
 }
 
-int bloom_check(struct bloom *bloom, const void *buffer, int len) {
-  return bloom_check_add(bloom, buffer, len, 0);
+inline static int check_hashes(struct bloom *bloom, size_t a, size_t b) {
+  register size_t x;
+  register unsigned int i;
+  for (i = 0; i < bloom->hashes; i++) {
+    x = BIT_INDEX(bloom, a, b, i);
+    if (!test_bit(bloom->bf, x)) {
+      if (bloom->stats) stats_lookup(bloom->stats, i + 1, 0);
+      return 0;
+    }
+  }
+  if (bloom->stats) stats_lookup(bloom->stats, bloom->hashes, 1);
+  return 1;
 }
 
-int bloom_check_ns(struct bloom *bloom, const void *buffer, int len) {
-  register size_t a = HASH_FN(buffer, len, bloom->hashSeed);
-  register size_t b = HASH_FN(buffer, len, a);
+inline static void add_hashes(struct bloom *bloom, size_t a, size_t b) {
   register size_t x;
   register unsigned int i;
   for (i = 0; i < bloom->hashes; i++) {
-    x = (a + i * b) % bloom->bits;
-    if (!test_bit(bloom->bf, x)) return 0;
+    x = BIT_INDEX(bloom, a, b, i);
+    set_bit(bloom->bf, x);
   }
-  return 1;
+  if (bloom->stats) stats_add(bloom->stats);
+}
+
+inline static int same_hash(const struct bloom *bloom,
+                            const struct bloom_key_hash *hash) {
+  return hash->hash_id == bloom->hash_id && hash->seed == bloom->hashSeed;
+}
+
+int bloom_check(struct bloom *bloom, const void *buffer, int len) {
+  BLOOM_PROBE2(check__start, bloom, len);
+  int rv = bloom_check_add(bloom, buffer, len, 0);
+  BLOOM_PROBE3(check__done, bloom, len, rv);
+  return rv;
+}
+
+int bloom_check_ns(struct bloom *bloom, const void *buffer, int len) {
+  BLOOM_PROBE2(check__start, bloom, len);
+  register size_t a = HASH_FN(bloom, buffer, len, bloom->hashSeed);
+  register size_t b = HASH_FN(bloom, buffer, len, a);
+  int rv = check_hashes(bloom, a, b);
+  BLOOM_PROBE3(check__done, bloom, len, rv);
+  return rv;
 }
 
 int bloom_add(struct bloom *bloom, const void *buffer, int len) {
-  return bloom_check_add(bloom, buffer, len, 1);
+  BLOOM_PROBE2(add__start, bloom, len);
+  int rv = bloom_check_add(bloom, buffer, len, 1);
+  BLOOM_PROBE3(add__done, bloom, len, rv);
+  return rv;
 }
 
 void bloom_add_ns(struct bloom *bloom, const void *buffer, int len) {
-  register size_t a = HASH_FN(buffer, len, bloom->hashSeed);
-  register size_t b = HASH_FN(buffer, len, a);
+  BLOOM_PROBE2(add__start, bloom, len);
+  register size_t a = HASH_FN(bloom, buffer, len, bloom->hashSeed);
+  register size_t b = HASH_FN(bloom, buffer, len, a);
+  add_hashes(bloom, a, b);
+  BLOOM_PROBE3(add__done, bloom, len, -1);
+}
+
+void bloom_add_atomic(struct bloom *bloom, const void *buffer, int len) {
+  BLOOM_PROBE2(add__start, bloom, len);
+  register size_t a = HASH_FN(bloom, buffer, len, bloom->hashSeed);
+  register size_t b = HASH_FN(bloom, buffer, len, a);
   register size_t x;
   register unsigned int i;
   for (i = 0; i < bloom->hashes; i++) {
-    x = (a + i * b) % bloom->bits;
-    set_bit(bloom->bf, x);
+    x = BIT_INDEX(bloom, a, b, i);
+    set_bit_atomic(bloom->bf, x);
+  }
+  if (bloom->stats) stats_add(bloom->stats);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  BLOOM_PROBE3(add__done, bloom, len, -1);
+}
+
+// Bulk inserts into filters of BLOOM_PARTITION_BYTES or more (below that,
+// the filter mostly stays in the last level cache) set bits a region (about
+// an L2 cache) at a time, in batches of this many bit positions, fanning out
+// to at most this many regions.
+#define BLOOM_PARTITION_BYTES (4u << 20u)
+#define BLOOM_REGION_SHIFT 21 /* bits, 256 KiB */
+#define BLOOM_BATCH_PROBES (1u << 18u)
+#define BLOOM_MAX_REGIONS 4096
+
+static void add_many(struct bloom *bloom, const void *keys, int len, size_t n,
+                     int atomic) {
+  const unsigned char *key = (const unsigned char *) keys;
+  unsigned int shift = BLOOM_REGION_SHIFT, i;
+  while (((bloom->bits - 1) >> shift) >= BLOOM_MAX_REGIONS) shift++;
+  size_t regions = ((bloom->bits - 1) >> shift) + 1;
+  size_t batch = BLOOM_BATCH_PROBES / bloom->hashes;
+  size_t *pos = NULL, *sorted = NULL, *offset = NULL;
+  if (bloom->bytes >= BLOOM_PARTITION_BYTES && n > batch / 4) {
+    pos = (size_t *) malloc(batch * bloom->hashes * sizeof(size_t));
+    sorted = (size_t *) malloc(batch * bloom->hashes * sizeof(size_t));
+    offset = (size_t *) malloc((regions + 1) * sizeof(size_t));
+  }
+  if (pos == NULL || sorted == NULL || offset == NULL) {
+    // mostly cached (or too few keys to pay off): key by key
+    for (; n > 0; n--, key += len) {
+      size_t a = HASH_FN(bloom, key, len, bloom->hashSeed);
+      size_t b = HASH_FN(bloom, key, len, a);
+      if (atomic) {
+        for (i = 0; i < bloom->hashes; i++)
+          set_bit_atomic(bloom->bf, BIT_INDEX(bloom, a, b, i));
+        if (bloom->stats) stats_add(bloom->stats);
+      } else {
+        add_hashes(bloom, a, b);
+      }
+    }
+  } else {
+    while (n > 0) {
+      size_t keys_now = n < batch ? n : batch, m = 0, j, r;
+      memset(offset, 0, (regions + 1) * sizeof(size_t));
+      for (j = 0; j < keys_now; j++, key += len) {
+        size_t a = HASH_FN(bloom, key, len, bloom->hashSeed);
+        size_t b = HASH_FN(bloom, key, len, a);
+        for (i = 0; i < bloom->hashes; i++) {
+          size_t x = BIT_INDEX(bloom, a, b, i);
+          pos[m++] = x;
+          offset[(x >> shift) + 1]++;
+        }
+        if (bloom->stats) stats_add(bloom->stats);
+      }
+      // counting sort by region, then set the bits region by region
+      for (r = 1; r < regions; r++) offset[r] += offset[r - 1];
+      for (j = 0; j < m; j++) sorted[offset[pos[j] >> shift]++] = pos[j];
+      if (atomic) {
+        for (j = 0; j < m; j++) set_bit_atomic(bloom->bf, sorted[j]);
+      } else {
+        for (j = 0; j < m; j++) set_bit(bloom->bf, sorted[j]);
+      }
+      n -= keys_now;
+    }
+  }
+  free(pos);
+  free(sorted);
+  free(offset);
+  if (atomic) __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void bloom_add_many(struct bloom *bloom, const void *keys, int len,
+                    size_t n) {
+  add_many(bloom, keys, len, n, 0);
+}
+
+void bloom_add_many_atomic(struct bloom *bloom, const void *keys, int len,
+                           size_t n) {
+  add_many(bloom, keys, len, n, 1);
+}
+
+void bloom_hash_key(const struct bloom *bloom, const void *buffer, int len,
+                    struct bloom_key_hash *out) {
+  out->a = HASH_FN(bloom, buffer, len, bloom->hashSeed);
+  out->b = HASH_FN(bloom, buffer, len, out->a);
+  out->seed = bloom->hashSeed;
+  out->hash_id = bloom->hash_id;
+}
+
+int bloom_add_hash(struct bloom *bloom, const struct bloom_key_hash *hash) {
+  if (!same_hash(bloom, hash)) return -1;
+  BLOOM_PROBE2(add__start, bloom, 0);
+  add_hashes(bloom, (size_t) hash->a, (size_t) hash->b);
+  BLOOM_PROBE3(add__done, bloom, 0, -1);
+  return 0;
+}
+
+int bloom_check_hash(struct bloom *bloom, const struct bloom_key_hash *hash) {
+  if (!same_hash(bloom, hash)) return -1;
+  BLOOM_PROBE2(check__start, bloom, 0);
+  int rv = check_hashes(bloom, (size_t) hash->a, (size_t) hash->b);
+  BLOOM_PROBE3(check__done, bloom, 0, rv);
+  return rv;
+}
+
+size_t bloom_check_hash_many(struct bloom *const *blooms, size_t n,
+                             const struct bloom_key_hash *hash,
+                             int *results) {
+  size_t i, found = 0;
+  for (i = 0; i < n; i++) {
+    if (same_hash(blooms[i], hash)) {
+      size_t x = BIT_INDEX(blooms[i], (size_t) hash->a, 0, 0);
+      __builtin_prefetch(blooms[i]->bf + (x >> 3u));
+    }
+  }
+  for (i = 0; i < n; i++) {
+    results[i] = bloom_check_hash(blooms[i], hash);
+    if (results[i] == 1) found++;
   }
+  return found;
 }
 
 void bloom_print(struct bloom *bloom) {
   printf("bloom at %p\n", (void *) bloom);
   printf(" ->entries = %lu\n", bloom->entries);
   printf(" ->error = %f\n", bloom->error);
-  printf(" ->bits = %lu\n", bloom->bits);
+  printf(" ->bits = %lu%s\n", bloom->bits,
+         bloom->mask ? " (power of two)" : "");
   printf(" ->bits per elem = %f\n", bloom->bpe);
   printf(" ->bytes = %lu\n", bloom->bytes);
   printf(" ->hash functions = %d\n", bloom->hashes);
-#ifdef USE_XXHASH
-  const char *hash_fn = "XXHASH";
-#elif defined(USE_WYHASH)
-  const char *hash_fn = "WYHASH";
-#else
-  const char *hash_fn = "MURMURHASH";
-#endif
-  printf(" ->hash function type = %s\n", hash_fn);
+  printf(" ->hash function type = %s (id %d)\n",
+         bloom_hash_name(bloom->hash_id), bloom->hash_id);
 }
 
 void bloom_free(struct bloom *bloom) {
+  BLOOM_PROBE1(free, bloom);
   if (bloom->ready) {
 #ifdef DEBUG
     printf("Release memory for the byte array\n");
 #endif
-    free(bloom->bf);
+    if (bloom->alloc == BLOOM_ALLOC_HEAP)
+      free(bloom->bf);
+    else
+      munmap(bloom->bf, bloom->mapped);
   }
+  bloom_stats_disable(bloom);
   bloom->bf = NULL;
+  bloom->alloc = BLOOM_ALLOC_HEAP;
+  bloom->mapped = 0;
   bloom->ready = 0;
 }
 
+// Each thread of a parallel clear zeroes at least this much.
+#define BLOOM_CLEAR_CHUNK (64u << 20u)
+#define BLOOM_CLEAR_MAX_THREADS 16
+
+struct clear_job {
+  unsigned char *p;
+  size_t len;
+};
+
+static void *clear_range(void *arg) {
+  struct clear_job *job = (struct clear_job *) arg;
+  memset(job->p, 0, job->len);
+  return NULL;
+}
+
+/* memset(p, 0, len) split over up to BLOOM_CLEAR_MAX_THREADS threads; parts
+ * whose thread cannot be started are cleared by the caller. */
+static void parallel_clear(unsigned char *p, size_t len) {
+  struct clear_job jobs[BLOOM_CLEAR_MAX_THREADS];
+  pthread_t threads[BLOOM_CLEAR_MAX_THREADS];
+  int started[BLOOM_CLEAR_MAX_THREADS];
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t n = len / BLOOM_CLEAR_CHUNK, part, i;
+  if (cpus > 0 && n > (size_t) cpus) n = (size_t) cpus;
+  if (n > BLOOM_CLEAR_MAX_THREADS) n = BLOOM_CLEAR_MAX_THREADS;
+  if (n < 2) {
+    memset(p, 0, len);
+    return;
+  }
+  part = (len / n + 4095) / 4096 * 4096;
+  for (i = 0; i < n; i++) {
+    jobs[i].p = p + i * part;
+    jobs[i].len = i + 1 < n ? part : len - i * part;
+    started[i] = i > 0 && pthread_create(&threads[i], NULL, clear_range,
+                                         &jobs[i]) == 0;
+  }
+  for (i = 0; i < n; i++) {
+    if (!started[i]) clear_range(&jobs[i]);
+  }
+  for (i = 1; i < n; i++) {
+    if (started[i]) pthread_join(threads[i], NULL);
+  }
+}
+
+/* Zero pages instead of zeroed bytes: the kernel drops the pages and maps
+ * the zero page on the next access, whatever the size of the filter. */
+static int drop_pages(struct bloom *bloom) {
+#if defined(__linux__) && defined(MADV_DONTNEED)
+  // private anonymous pages read back as zeros after MADV_DONTNEED
+  return madvise(bloom->bf, bloom->mapped, MADV_DONTNEED);
+#elif defined(MAP_ANONYMOUS) && defined(MAP_FIXED)
+  void *map = mmap(bloom->bf, bloom->mapped, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  return map == MAP_FAILED ? -1 : 0;
+#else
+  return -1;
+#endif
+}
+
 int bloom_reset(struct bloom *bloom) {
   if (!bloom->ready)
     return 1;
-  memset(bloom->bf, 0, bloom->bytes);
+  if (bloom->alloc == BLOOM_ALLOC_MMAP) {
+    if (drop_pages(bloom) != 0)
+      memset(bloom->bf, 0, bloom->bytes); // LCOV_EXCL_LINE
+  } else if (bloom->alloc == BLOOM_ALLOC_HUGE) {
+    // dropping them would split the huge pages, so clear in place instead
+    parallel_clear(bloom->bf, bloom->bytes);
+  } else {
+    memset(bloom->bf, 0, bloom->bytes);
+  }
 #ifdef COUNTING_SET_BITS_ON
   bloom.num_set_bits = 0;
 #endif
+  BLOOM_PROBE1(reset, bloom);
+  return 0;
+}
+
+static int can_fold(const struct bloom *bloom, unsigned int factor) {
+  return bloom->ready && bloom->mask != 0 && factor >= 2 &&
+         (factor & (factor - 1)) == 0 &&
+         bloom->bits / factor >= BLOOM_MIN_POW2_BITS;
+}
+
+/* ORs the `factor` parts of the bit field into `out`. OR works byte by
+ * byte, so the words are read in host byte order. */
+static void fold_into(const struct bloom *bloom, unsigned int factor,
+                      uint64_t *out) {
+  size_t words = bloom->bytes / factor / 8, i;
+  unsigned int part;
+  memcpy(out, bloom->bf, words * 8);
+  for (part = 1; part < factor; part++) {
+    const unsigned char *src = bloom->bf + part * words * 8;
+    uint64_t w;
+    // the memcpy() is a plain (unaligned) load: at -O3 gcc turns the loop
+    // into 16-byte vector ORs
+    for (i = 0; i < words; i++) {
+      memcpy(&w, src + i * 8, sizeof(w));
+      out[i] |= w;
+    }
+  }
+}
+
+double bloom_fold_fpr(const struct bloom *bloom, unsigned int factor) {
+  if (!can_fold(bloom, factor))
+    return -1;
+  size_t words = bloom->bytes / factor / 8, i;
+  uint64_t *folded = (uint64_t *) malloc(words * sizeof(uint64_t));
+  if (folded == NULL) // LCOV_EXCL_LINE
+    return -1;        // LCOV_EXCL_LINE
+  fold_into(bloom, factor, folded);
+  uint64_t set = 0;
+  for (i = 0; i < words; i++) {
+    set += (uint64_t) __builtin_popcountll(folded[i]);
+  }
+  free(folded);
+  return pow((double) set / (double) (words * 64), bloom->hashes);
+}
+
+int bloom_fold(struct bloom *bloom, unsigned int factor) {
+  if (!can_fold(bloom, factor))
+    return 1;
+  size_t words = bloom->bytes / factor / 8;
+  uint64_t *folded = (uint64_t *) malloc(words * sizeof(uint64_t));
+  if (folded == NULL) // LCOV_EXCL_LINE
+    return 1;         // LCOV_EXCL_LINE
+  fold_into(bloom, factor, folded);
+  memcpy(bloom->bf, folded, words * 8);
+  free(folded);
+
+  bloom->bits /= factor;
+  bloom->bytes /= factor;
+  bloom->mask = bloom->bits - 1;
+  if (bloom->alloc == BLOOM_ALLOC_HEAP) {
+    unsigned char *bf = (unsigned char *) realloc(bloom->bf, bloom->bytes);
+    if (bf != NULL) bloom->bf = bf;
+  } else {
+    // give back the whole pages past the folded bit field
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t len = (bloom->bytes + page - 1) / page * page;
+    if (len < bloom->mapped && munmap(bloom->bf + len, bloom->mapped - len) == 0)
+      bloom->mapped = len;
+  }
+  return 0;
+}
+
+#define BLOOM_SERIAL_MAGIC 0x464d4c42u /* "BLMF" */
+// Version 1 is written for murmur2 filters, so readers which predate
+// runtime hash selection can still load them; its 16-bit field at offset 6
+// is reserved (0). Version 2 stores the hash id there. Version 3 is the
+// compressed form: the header is followed by a 16-byte codec header (codec,
+// codec parameter, 6 reserved bytes, number of set bits or 0 for RAW) and
+// the payload.
+#define BLOOM_SERIAL_VERSION_HASH 2
+#define BLOOM_SERIAL_VERSION_COMPRESSED 3
+#define BLOOM_SERIAL_VERSION 3
+#define BLOOM_SERIAL_POW2 1u /* power-of-two sizing, maybe folded */
+#define BLOOM_SERIAL_HEADER 48
+#define BLOOM_CODEC_HEADER 16
+#define RICE_MAX_PARAM 56
+
+static unsigned char *put_le(unsigned char *p, uint64_t v, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    p[i] = (unsigned char) (v >> (8 * i));
+  }
+  return p + n;
+}
+
+static const unsigned char *get_le(const unsigned char *p, uint64_t *v,
+                                   int n) {
+  int i;
+  *v = 0;
+  for (i = 0; i < n; i++) {
+    *v |= (uint64_t) p[i] << (8 * i);
+  }
+  return p + n;
+}
+
+inline static uint64_t load_le64(const unsigned char *p) {
+  uint64_t v;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(&v, p, sizeof(v));
+#else
+  get_le(p, &v, 8);
+#endif
+  return v;
+}
+
+inline static void store_le64(unsigned char *p, uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(p, &v, sizeof(v));
+#else
+  put_le(p, v, 8);
+#endif
+}
+
+/* The 8 bytes at offset i of a buffer of `len` bytes, zero padded. */
+inline static uint64_t load_tail(const unsigned char *p, size_t len,
+                                 size_t i) {
+  uint64_t v;
+  if (i + 8 <= len)
+    return load_le64(p + i);
+  get_le(p + i, &v, (int) (len - i));
+  return v;
+}
+
+static unsigned char *put_header(const struct bloom *bloom, unsigned char *p,
+                                 int version) {
+  uint64_t error_bits;
+  memcpy(&error_bits, &bloom->error, sizeof(error_bits));
+
+  p = put_le(p, BLOOM_SERIAL_MAGIC, 4);
+  p = put_le(p, (uint64_t) version, 2);
+  // hash id in the low byte, BLOOM_SERIAL_* flags in the high byte
+  p = put_le(p, (uint64_t) bloom->hash_id |
+                    (bloom->mask ? BLOOM_SERIAL_POW2 << 8u : 0u), 2);
+  p = put_le(p, bloom->entries, 8);
+  p = put_le(p, error_bits, 8);
+  p = put_le(p, bloom->bits, 8);
+  p = put_le(p, (uint64_t) bloom->hashes, 4);
+  p = put_le(p, bloom->hashSeed, 4);
+  p = put_le(p, bloom->bytes, 8);
+  return p;
+}
+
+size_t bloom_serialized_size(const struct bloom *bloom) {
+  return BLOOM_SERIAL_HEADER + bloom->bytes;
+}
+
+int bloom_serialize(const struct bloom *bloom, void *buffer, size_t len) {
+  if (!bloom->ready || len < bloom_serialized_size(bloom)) {
+    BLOOM_PROBE3(save, bloom, len, 1);
+    return 1;
+  }
+
+  unsigned char *p = put_header(
+      bloom, (unsigned char *) buffer,
+      bloom->hash_id == BLOOM_HASH_MURMUR2 && !bloom->mask
+          ? 1
+          : BLOOM_SERIAL_VERSION_HASH);
+  memcpy(p, bloom->bf, bloom->bytes);
+  BLOOM_PROBE3(save, bloom, len, 0);
+  return 0;
+}
+
+/*
+ * Golomb-Rice coding of the gaps between set bits: gap g is written as
+ * g >> k zero bits and a one bit, then the low k bits of g. Bits are packed
+ * LSB first into 64-bit little-endian words.
+ */
+struct bit_writer {
+  unsigned char *out;
+  size_t cap;       // bytes available at out
+  size_t pos;       // bytes written
+  uint64_t acc;
+  unsigned int used;
+};
+
+// n <= 57, and v has no bits set above n
+inline static int put_bits(struct bit_writer *w, uint64_t v, unsigned int n) {
+  w->acc |= v << w->used;
+  w->used += n;
+  if (w->used >= 64) {
+    if (w->pos + 8 > w->cap)
+      return 1;
+    store_le64(w->out + w->pos, w->acc);
+    w->pos += 8;
+    w->used -= 64;
+    w->acc = w->used ? v >> (n - w->used) : 0;
+  }
+  return 0;
+}
+
+/* Rice codes the set bits of bf, or of bf ^ base if base is not NULL. */
+static int rice_encode(const unsigned char *bf, const unsigned char *base,
+                       size_t bytes, unsigned int k, unsigned char *out,
+                       size_t cap, size_t *written, uint64_t *count) {
+  struct bit_writer w = {out, cap, 0, 0, 0};
+  uint64_t next = 0, mask = (1ull << k) - 1;
+  *count = 0;
+  size_t i;
+  for (i = 0; i < bytes; i += 8) {
+    uint64_t word = load_tail(bf, bytes, i);
+    if (base != NULL) word ^= load_tail(base, bytes, i);
+    for (; word != 0; word &= word - 1) {
+      uint64_t x = i * 8 + (uint64_t) __builtin_ctzll(word);
+      uint64_t gap = x - next, q = gap >> k;
+      next = x + 1;
+      (*count)++;
+      for (; q >= 32; q -= 32) {
+        if (put_bits(&w, 0, 32)) return 1;
+      }
+      if (q + 1 + k <= 57) {
+        // unary and remainder in one go
+        if (put_bits(&w, (1ull << q) | ((gap & mask) << (q + 1)),
+                     (unsigned int) (q + 1 + k)))
+          return 1;
+      } else if (put_bits(&w, 1ull << q, (unsigned int) q + 1) ||
+                 put_bits(&w, gap & mask, k)) {
+        return 1;
+      }
+    }
+  }
+  if (w.used > 0) {
+    if (w.pos + 8 > w.cap)
+      return 1;
+    store_le64(w.out + w.pos, w.acc);
+    w.pos += 8;
+  }
+  *written = w.pos;
+  return 0;
+}
+
+/* At least 57 bits of the stream from bit `pos` on, zeros past its end. */
+inline static uint64_t peek_bits(const unsigned char *in, size_t len,
+                                 uint64_t pos) {
+  size_t byte = (size_t) (pos >> 3u);
+  uint64_t v;
+  if (byte + 8 <= len) {
+    v = load_le64(in + byte);
+  } else if (byte < len) {
+    get_le(in + byte, &v, (int) (len - byte));
+  } else {
+    return 0;
+  }
+  return v >> (pos & 7u);
+}
+
+/*
+ * Codes are read with an unaligned 64-bit load: count trailing zeros for
+ * the unary part, then a shift and mask for the remainder.
+ */
+/* Flips the `count` bits coded in `in` in bf (only validates if bf is
+ * NULL); positions are strictly increasing, so no bit is flipped twice. */
+static int rice_decode(unsigned char *bf, size_t bytes, unsigned int k,
+                       uint64_t count, const unsigned char *in, size_t len) {
+  uint64_t pos = 0, end = (uint64_t) len * 8, next = 0;
+  uint64_t mask = (1ull << k) - 1, limit = (uint64_t) bytes * 8;
+  for (; count > 0; count--) {
+    uint64_t q = 0, bits;
+    while ((bits = peek_bits(in, len, pos)) == 0) {
+      if (pos >= end)
+        return 1;
+      q += 56;
+      pos += 56;
+    }
+    unsigned int tz = (unsigned int) __builtin_ctzll(bits);
+    uint64_t r;
+    q += tz;
+    if (tz + 1 + k <= 57) {
+      r = (bits >> (tz + 1)) & mask;
+    } else {
+      r = peek_bits(in, len, pos + tz + 1) & mask;
+    }
+    pos += tz + 1 + k;
+    if (pos > end || q > (limit >> k))
+      return 1;
+    uint64_t x = next + ((q << k) | r);
+    if (x >= limit)
+      return 1;
+    if (bf != NULL) bf[x >> 3u] ^= (unsigned char) (1u << (x & 7u));
+    next = x + 1;
+  }
+  return 0;
+}
+
+/* Golomb-Rice parameter for gaps between bits set with probability p. */
+static unsigned int rice_param(double p) {
+  if (p <= 0 || p >= 0.5)
+    return 0;
+  // -log(golden ratio - 1) = 0.4812...
+  double k = 1 + floor(log2(0.481211825059603 / -log1p(-p)));
+  return k < 0 ? 0 : (k > RICE_MAX_PARAM ? RICE_MAX_PARAM : (unsigned int) k);
+}
+
+/* Fill ratio of the bit field; sampled for large filters. */
+static double fill_ratio(const struct bloom *bloom) {
+  const size_t block = 64, samples = 1024;
+  size_t stride = 1, i, j;
+  uint64_t set = 0, seen = 0;
+  if (bloom->bytes > samples * block * 16)
+    stride = bloom->bytes / (samples * block);
+  for (i = 0; i + block <= bloom->bytes; i += stride * block) {
+    for (j = 0; j < block; j += 8) {
+      set += (uint64_t) __builtin_popcountll(load_le64(bloom->bf + i + j));
+    }
+    seen += block * 8;
+  }
+  for (; stride == 1 && i < bloom->bytes; i++) {
+    set += (uint64_t) __builtin_popcount(bloom->bf[i]);
+    seen += 8;
+  }
+  return seen ? (double) set / (double) seen : 0;
+}
+
+size_t bloom_compressed_bound(const struct bloom *bloom) {
+  return BLOOM_SERIAL_HEADER + BLOOM_CODEC_HEADER + bloom->bytes;
+}
+
+int bloom_serialize_compressed(const struct bloom *bloom, int codec,
+                               void *buffer, size_t len, size_t *written) {
+  if (!bloom->ready || len < bloom_compressed_bound(bloom) ||
+      codec < BLOOM_CODEC_AUTO || codec > BLOOM_CODEC_RICE) {
+    BLOOM_PROBE3(save, bloom, len, 1);
+    return 1;
+  }
+
+  double fill = codec == BLOOM_CODEC_RAW ? 1 : fill_ratio(bloom);
+  unsigned int k = rice_param(fill);
+  if (codec == BLOOM_CODEC_AUTO) {
+    // Rice needs about k + 2 bits per set bit, raw one bit per bit
+    codec = fill * (k + 2) < 0.9 ? BLOOM_CODEC_RICE : BLOOM_CODEC_RAW;
+  }
+
+  unsigned char *p = put_header(bloom, (unsigned char *) buffer,
+                                BLOOM_SERIAL_VERSION_COMPRESSED);
+  unsigned char *payload = p + BLOOM_CODEC_HEADER;
+  size_t size = 0;
+  uint64_t count = 0;
+  if (codec == BLOOM_CODEC_RICE) {
+    // no smaller than raw: fall back
+    size_t cap = bloom->bytes / 8 * 8;
+    if (rice_encode(bloom->bf, NULL, bloom->bytes, k, payload, cap, &size,
+                    &count) != 0)
+      codec = BLOOM_CODEC_RAW;
+  }
+  if (codec == BLOOM_CODEC_RAW) {
+    k = 0;
+    count = 0;
+    size = bloom->bytes;
+    memcpy(payload, bloom->bf, size);
+  }
+  p = put_le(p, (uint64_t) codec, 1);
+  p = put_le(p, k, 1);
+  p = put_le(p, 0, 6);
+  put_le(p, count, 8);
+
+  *written = BLOOM_SERIAL_HEADER + BLOOM_CODEC_HEADER + size;
+  BLOOM_PROBE3(save, bloom, *written, 0);
+  return 0;
+}
+
+static int deserialize(struct bloom *bloom, const void *buffer, size_t len) {
+  uint64_t magic, version, hash_id, flags, entries, error_bits, bits, hashes, seed,
+      bytes, codec = BLOOM_CODEC_RAW, param = 0, count = 0;
+  double error;
+
+  bloom->ready = 0;
+  if (len < BLOOM_SERIAL_HEADER)
+    return 1;
+
+  const unsigned char *p = (const unsigned char *) buffer;
+  p = get_le(p, &magic, 4);
+  p = get_le(p, &version, 2);
+  p = get_le(p, &hash_id, 2);
+  p = get_le(p, &entries, 8);
+  p = get_le(p, &error_bits, 8);
+  p = get_le(p, &bits, 8);
+  p = get_le(p, &hashes, 4);
+  p = get_le(p, &seed, 4);
+  p = get_le(p, &bytes, 8);
+  memcpy(&error, &error_bits, sizeof(error));
+  len -= BLOOM_SERIAL_HEADER;
+  flags = hash_id >> 8u;
+  hash_id &= 0xffu;
+
+  if (magic != BLOOM_SERIAL_MAGIC || version < 1 ||
+      version > BLOOM_SERIAL_VERSION)
+    return 1;
+  if (version == 1 && (hash_id != BLOOM_HASH_MURMUR2 || flags != 0))
+    return 1;
+  if ((flags & ~BLOOM_SERIAL_POW2) != 0)
+    return 1;
+  if (!bloom_hash_available((int) hash_id))
+    return 1;
+  if (!(entries > 0 && error > 0 && error < 1.0))
+    return 1;
+  if (version == BLOOM_SERIAL_VERSION_COMPRESSED) {
+    uint64_t reserved;
+    if (len < BLOOM_CODEC_HEADER)
+      return 1;
+    p = get_le(p, &codec, 1);
+    p = get_le(p, &param, 1);
+    p = get_le(p, &reserved, 6);
+    p = get_le(p, &count, 8);
+    len -= BLOOM_CODEC_HEADER;
+    if (reserved != 0 || codec > BLOOM_CODEC_RICE || param > RICE_MAX_PARAM)
+      return 1;
+  }
+  if (codec == BLOOM_CODEC_RAW ? bytes != len : len % 8 != 0)
+    return 1;
+
+  if (flags & BLOOM_SERIAL_POW2) {
+    // sized to a power of two and possibly folded since
+    bloom_init_wo_allocation_sizing(bloom, entries, error, BLOOM_SIZING_POW2);
+    if (bits < BLOOM_MIN_POW2_BITS || bits > bloom->bits ||
+        (bits & (bits - 1)) != 0)
+      return 1;
+    bloom->bits = bits;
+    bloom->bytes = bits / 8;
+    bloom->mask = bits - 1;
+  } else {
+    bloom_init_wo_allocation(bloom, entries, error);
+  }
+  if (bloom->bits != bits || bloom->bytes != bytes ||
+      (uint64_t) bloom->hashes != hashes)
+    return 1;
+  bloom->hashSeed = (unsigned int) seed;
+  bloom_set_hash(bloom, (int) hash_id);
+
+  if (codec == BLOOM_CODEC_RAW) {
+    bloom->bf = (unsigned char *) malloc(bloom->bytes);
+    if (bloom->bf == NULL) // LCOV_EXCL_LINE
+      return 1;            // LCOV_EXCL_LINE
+    memcpy(bloom->bf, p, bloom->bytes);
+  } else {
+    bloom->bf = (unsigned char *) calloc(bloom->bytes, sizeof(unsigned char));
+    if (bloom->bf == NULL) // LCOV_EXCL_LINE
+      return 1;            // LCOV_EXCL_LINE
+    if (rice_decode(bloom->bf, bloom->bytes, (unsigned int) param, count, p,
+                    len) != 0) {
+      free(bloom->bf);
+      bloom->bf = NULL;
+      return 1;
+    }
+  }
+  bloom->ready = 1;
+  return 0;
+}
+
+int bloom_deserialize(struct bloom *bloom, const void *buffer, size_t len) {
+  int rv = deserialize(bloom, buffer, len);
+  BLOOM_PROBE3(load, bloom, len, rv);
+  return rv;
+}
+
+#define BLOOM_DELTA_MAGIC 0x444d4c42u /* "BLMD" */
+#define BLOOM_DELTA_VERSION 1
+#define BLOOM_DELTA_HEADER 56
+
+uint64_t bloom_checksum(const struct bloom *bloom) {
+  return wyhash(bloom->bf, bloom->bytes, bloom->bytes, _wyp);
+}
+
+static int same_shape(const struct bloom *a, const struct bloom *b) {
+  return a->bits == b->bits && a->bytes == b->bytes &&
+         a->hashes == b->hashes && a->hashSeed == b->hashSeed &&
+         a->hash_id == b->hash_id;
+}
+
+size_t bloom_delta_bound(const struct bloom *bloom) {
+  // Rice codes of any bit pattern take less than two bits per bit
+  return BLOOM_DELTA_HEADER + 2 * (bloom->bytes / 8 * 8 + 8);
+}
+
+int bloom_diff(const struct bloom *bloom, const struct bloom *older,
+               void *buffer, size_t len, size_t *written) {
+  if (!bloom->ready || !older->ready || !same_shape(bloom, older) ||
+      len < bloom_delta_bound(bloom))
+    return 1;
+
+  // the changed bits, counted only in the (few) changed words
+  uint64_t changed = 0;
+  size_t i;
+  for (i = 0; i < bloom->bytes; i += 8) {
+    uint64_t word = load_tail(bloom->bf, bloom->bytes, i) ^
+                    load_tail(older->bf, bloom->bytes, i);
+    if (word != 0) changed += (uint64_t) __builtin_popcountll(word);
+  }
+  unsigned int k = rice_param((double) changed / (double) bloom->bits);
+
+  unsigned char *p = (unsigned char *) buffer;
+  size_t size;
+  uint64_t count;
+  if (rice_encode(bloom->bf, older->bf, bloom->bytes, k,
+                  p + BLOOM_DELTA_HEADER, len - BLOOM_DELTA_HEADER, &size,
+                  &count) != 0)
+    return 1; // LCOV_EXCL_LINE
+
+  p = put_le(p, BLOOM_DELTA_MAGIC, 4);
+  p = put_le(p, BLOOM_DELTA_VERSION, 2);
+  p = put_le(p, (uint64_t) bloom->hash_id, 2);
+  p = put_le(p, bloom->bits, 8);
+  p = put_le(p, (uint64_t) bloom->hashes, 4);
+  p = put_le(p, bloom->hashSeed, 4);
+  p = put_le(p, bloom_checksum(older), 8);
+  p = put_le(p, bloom_checksum(bloom), 8);
+  p = put_le(p, k, 1);
+  p = put_le(p, 0, 7);
+  put_le(p, count, 8);
+  *written = BLOOM_DELTA_HEADER + size;
+  return 0;
+}
+
+int bloom_apply_delta(struct bloom *bloom, const void *delta, size_t len) {
+  uint64_t magic, version, hash_id, bits, hashes, seed, base, target, param,
+      reserved, count;
+  if (!bloom->ready || len < BLOOM_DELTA_HEADER)
+    return 1;
+
+  const unsigned char *p = (const unsigned char *) delta;
+  p = get_le(p, &magic, 4);
+  p = get_le(p, &version, 2);
+  p = get_le(p, &hash_id, 2);
+  p = get_le(p, &bits, 8);
+  p = get_le(p, &hashes, 4);
+  p = get_le(p, &seed, 4);
+  p = get_le(p, &base, 8);
+  p = get_le(p, &target, 8);
+  p = get_le(p, &param, 1);
+  p = get_le(p, &reserved, 7);
+  p = get_le(p, &count, 8);
+  len -= BLOOM_DELTA_HEADER;
+
+  if (magic != BLOOM_DELTA_MAGIC || version != BLOOM_DELTA_VERSION ||
+      reserved != 0 || param > RICE_MAX_PARAM || len % 8 != 0)
+    return 1;
+  if (hash_id != (uint64_t) bloom->hash_id || bits != bloom->bits ||
+      hashes != (uint64_t) bloom->hashes || seed != bloom->hashSeed)
+    return 1;
+  if (base != bloom_checksum(bloom))
+    return 1;
+  // validate first, so a bad delta leaves the filter untouched
+  if (rice_decode(NULL, bloom->bytes, (unsigned int) param, count, p, len))
+    return 1;
+
+  rice_decode(bloom->bf, bloom->bytes, (unsigned int) param, count, p, len);
+  if (bloom_checksum(bloom) != target) {
+    // flipping the same bits again restores the base
+    rice_decode(bloom->bf, bloom->bytes, (unsigned int) param, count, p, len);
+    return 1;
+  }
   return 0;
 }
 
+int bloom_hash_available(int hash_id) {
+  return hash_id >= 0 && hash_id < BLOOM_HASH_COUNT &&
+         hash_table[hash_id].fn != NULL;
+}
+
+const char *bloom_hash_name(int hash_id) {
+  if (hash_id < 0 || hash_id >= BLOOM_HASH_COUNT)
+    return "unknown";
+  return hash_table[hash_id].name;
+}
+
+bloom_hash_fn bloom_hash_function(int hash_id) {
+  return bloom_hash_available(hash_id) ? hash_table[hash_id].fn : NULL;
+}
+
+int bloom_set_hash(struct bloom *bloom, int hash_id) {
+  if (!bloom_hash_available(hash_id))
+    return 1;
+  bloom->hash_id = hash_id;
+  bloom->hash_fn = bloom_hash_function(hash_id);
+  return 0;
+}
+
+int bloom_stats_enable(struct bloom *bloom) {
+  if (!bloom->ready)
+    return 1;
+  if (bloom->stats)
+    return 0;
+  void *mem = calloc(1, sizeof(struct bloom_stats) + 63);
+  if (mem == NULL) // LCOV_EXCL_LINE
+    return 1;      // LCOV_EXCL_LINE
+  struct bloom_stats *stats =
+      (struct bloom_stats *) (((uintptr_t) mem + 63) & ~(uintptr_t) 63);
+  stats->mem = mem;
+  bloom->stats = stats;
+  return 0;
+}
+
+void bloom_stats_disable(struct bloom *bloom) {
+  if (bloom->stats)
+    free(bloom->stats->mem);
+  bloom->stats = NULL;
+}
+
+int bloom_stats_get(const struct bloom *bloom,
+                    struct bloom_stats_snapshot *out) {
+  unsigned int i, j;
+  size_t set_bits = 0;
+
+  memset(out, 0, sizeof(*out));
+  if (!bloom->ready || bloom->stats == NULL)
+    return 1;
+  for (i = 0; i < BLOOM_STATS_SHARDS; i++) {
+    const struct bloom_stats_shard *shard = &bloom->stats->shard[i];
+    out->adds += __atomic_load_n(&shard->adds, __ATOMIC_RELAXED);
+    out->lookups += __atomic_load_n(&shard->lookups, __ATOMIC_RELAXED);
+    out->positives += __atomic_load_n(&shard->positives, __ATOMIC_RELAXED);
+    out->probes += __atomic_load_n(&shard->probes, __ATOMIC_RELAXED);
+    for (j = 0; j < BLOOM_STATS_PROBE_BUCKETS; j++) {
+      out->probe_depth[j] +=
+          __atomic_load_n(&shard->probe_depth[j], __ATOMIC_RELAXED);
+    }
+  }
+
+  for (i = 0; i + sizeof(uint64_t) <= bloom->bytes; i += sizeof(uint64_t)) {
+    uint64_t w;
+    memcpy(&w, bloom->bf + i, sizeof(w));
+    set_bits += __builtin_popcountll(w);
+  }
+  for (; i < bloom->bytes; i++) {
+    set_bits += __builtin_popcount(bloom->bf[i]);
+  }
+  out->fill_ratio = (double) set_bits / (double) bloom->bits;
+  out->estimated_fpr = pow(out->fill_ratio, bloom->hashes);
+  return 0;
+}
+
+/* snprintf() at offset `pos` of `buffer`, returning the offset past the
+ * complete output even if it did not fit. */
+static size_t append(char *buffer, size_t len, size_t pos, const char *fmt,
+                     ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(pos < len ? buffer + pos : NULL, pos < len ? len - pos : 0,
+                    fmt, ap);
+  va_end(ap);
+  return n > 0 ? pos + (size_t) n : pos;
+}
+
+size_t bloom_stats_format(const struct bloom *bloom, const char *name,
+                          char *buffer, size_t len) {
+  static const char *counters[][2] = {
+      {"bloom_adds_total", "Keys added."},
+      {"bloom_lookups_total", "Membership checks."},
+      {"bloom_positives_total", "Membership checks which returned true."}};
+  struct bloom_stats_snapshot snap;
+  char label[256];
+  size_t pos = 0, l = 0;
+  uint64_t cumulative = 0;
+  unsigned int i;
+
+  if (bloom_stats_get(bloom, &snap) != 0)
+    return 0;
+  if (len > 0)
+    buffer[0] = '\0';
+
+  // label value, with backslash, double quote and newline escaped
+  for (; *name && l + 3 < sizeof(label); name++) {
+    if (*name == '\\' || *name == '"' || *name == '\n')
+      label[l++] = '\\';
+    label[l++] = *name == '\n' ? 'n' : *name;
+  }
+  label[l] = '\0';
+
+  uint64_t values[] = {snap.adds, snap.lookups, snap.positives};
+  for (i = 0; i < 3; i++) {
+    pos = append(buffer, len, pos,
+                 "# HELP %s %s\n# TYPE %s counter\n%s{filter=\"%s\"} %" PRIu64
+                 "\n",
+                 counters[i][0], counters[i][1], counters[i][0],
+                 counters[i][0], label, values[i]);
+  }
+
+  pos = append(buffer, len, pos,
+               "# HELP bloom_probe_depth Bits probed per membership check.\n"
+               "# TYPE bloom_probe_depth histogram\n");
+  for (i = 0; i + 1 < BLOOM_STATS_PROBE_BUCKETS; i++) {
+    cumulative += snap.probe_depth[i];
+    pos = append(buffer, len, pos,
+                 "bloom_probe_depth_bucket{filter=\"%s\",le=\"%u\"} %" PRIu64
+                 "\n",
+                 label, i + 1, cumulative);
+  }
+  pos = append(buffer, len, pos,
+               "bloom_probe_depth_bucket{filter=\"%s\",le=\"+Inf\"} %" PRIu64
+               "\nbloom_probe_depth_sum{filter=\"%s\"} %" PRIu64
+               "\nbloom_probe_depth_count{filter=\"%s\"} %" PRIu64 "\n",
+               label, snap.lookups, label, snap.probes, label, snap.lookups);
+
+  pos = append(buffer, len, pos,
+               "# HELP bloom_fill_ratio Fraction of the bits set.\n"
+               "# TYPE bloom_fill_ratio gauge\n"
+               "bloom_fill_ratio{filter=\"%s\"} %.6f\n"
+               "# HELP bloom_estimated_fpr Estimated false positive rate.\n"
+               "# TYPE bloom_estimated_fpr gauge\n"
+               "bloom_estimated_fpr{filter=\"%s\"} %.6g\n"
+               "# HELP bloom_size_bytes Size of the bit field.\n"
+               "# TYPE bloom_size_bytes gauge\n"
+               "bloom_size_bytes{filter=\"%s\"} %lu\n",
+               label, snap.fill_ratio, label, snap.estimated_fpr, label,
+               (unsigned long) bloom->bytes);
+  return pos;
+}
+
+int bloom_stats_write(const struct bloom *bloom, const char *name, FILE *out) {
+  size_t len = bloom_stats_format(bloom, name, NULL, 0);
+  if (len == 0)
+    return 1;
+  char *text = (char *) malloc(len + 1);
+  if (text == NULL) // LCOV_EXCL_LINE
+    return 1;       // LCOV_EXCL_LINE
+  // the filter may change in between, so format again into the buffer
+  len = bloom_stats_format(bloom, name, text, len + 1);
+  int rv = fwrite(text, 1, strlen(text), out) == strlen(text) ? 0 : 1;
+  free(text);
+  return rv;
+}
+
+int bloom_stats_export(const struct bloom *bloom, const char *name,
+                       const char *path) {
+  char *tmp = (char *) malloc(strlen(path) + 5);
+  if (tmp == NULL) // LCOV_EXCL_LINE
+    return 1;      // LCOV_EXCL_LINE
+  sprintf(tmp, "%s.tmp", path);
+
+  int rv = 1;
+  FILE *fp = fopen(tmp, "w");
+  if (fp != NULL) {
+    rv = bloom_stats_write(bloom, name, fp);
+    if (fclose(fp) != 0)
+      rv = 1;
+    if (rv == 0 && rename(tmp, path) != 0)
+      rv = 1;
+    if (rv != 0)
+      remove(tmp);
+  }
+  free(tmp);
+  return rv;
+}
+
 const char *bloom_version() { return MAKESTRING(BLOOM_VERSION); }
@@ -8,12 +8,33 @@
 #ifndef _BLOOM_H
 #define _BLOOM_H
 
+#include "stdint.h"
+#include "stdio.h"
 #include "stdlib.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct bloom_stats;
+
+/** ***************************************************************************
+ * Hash functions a filter can be built with. The id is part of the filter
+ * (see bloom_set_hash()) and of its serialized form, so filters built with
+ * different hashes can live in one process and be shipped between hosts.
+ * XXH3 is available when <xxhash.h> was found at build time, see
+ * bloom_hash_available().
+ *
+ */
+enum bloom_hash {
+  BLOOM_HASH_MURMUR2 = 0,
+  BLOOM_HASH_WYHASH = 1,
+  BLOOM_HASH_XXH3 = 2,
+  BLOOM_HASH_COUNT
+};
+
+typedef uint64_t (*bloom_hash_fn)(const void *key, int len, uint64_t seed);
+
 /** ***************************************************************************
  * Structure to keep track of one bloom filter.  Caller needs to
  * allocate this and pass it to the functions below. First call for
@@ -39,6 +60,14 @@ struct bloom {
 
   // Fields added by Long
   unsigned int hashSeed;
+  int hash_id;            // enum bloom_hash
+  bloom_hash_fn hash_fn;  // resolved from hash_id, once per filter
+  size_t mask;            // bits - 1 when sized to a power of two, else 0
+  int alloc;              // enum bloom_alloc of bf
+  size_t mapped;          // length of the mapping of bf, unless heap
+
+  // Runtime statistics, NULL unless enabled with bloom_stats_enable().
+  struct bloom_stats *stats;
 
 #ifdef COUNTING_SET_BITS_ON
   size_t num_set_bits;
@@ -101,6 +130,79 @@ int bloom_init(struct bloom *bloom, size_t entries, double error);
 void bloom_init_wo_allocation(struct bloom *bloom, size_t entries,
                               double error);
 
+/** ***************************************************************************
+ * Bit field sizing of bloom_init_sizing().
+ *
+ *     BLOOM_SIZING_OPTIMAL - the optimal number of bits (as bloom_init()).
+ *     BLOOM_SIZING_POW2    - the optimal number of bits rounded up to a power
+ *                            of two (at least BLOOM_MIN_POW2_BITS). Bits are
+ *                            then indexed with a mask instead of a division,
+ *                            and the filter can be shrunk with bloom_fold().
+ *
+ */
+enum bloom_sizing {
+  BLOOM_SIZING_OPTIMAL = 0,
+  BLOOM_SIZING_POW2 = 1
+};
+
+#define BLOOM_MIN_POW2_BITS 64
+
+/** ***************************************************************************
+ * As bloom_init(), with the bit field sized by `sizing` (enum
+ * bloom_sizing). The number of hash functions is that of bloom_init().
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (including an unknown sizing)
+ *
+ */
+int bloom_init_sizing(struct bloom *bloom, size_t entries, double error,
+                      int sizing);
+
+/** ***************************************************************************
+ * Where bloom_init_alloc() allocates the bit field.
+ *
+ *     BLOOM_ALLOC_HEAP - calloc(), as bloom_init(); bloom_reset() clears it
+ *                        with memset().
+ *     BLOOM_ALLOC_MMAP - anonymous mmap(): pages are zero-filled by the
+ *                        kernel on first touch rather than all upfront, and
+ *                        bloom_reset() hands them back (MADV_DONTNEED) in
+ *                        near-constant time instead of clearing every byte.
+ *     BLOOM_ALLOC_HUGE - anonymous mmap() aligned to and advised for 2 MiB
+ *                        transparent huge pages (fewer TLB misses on very
+ *                        large filters). Handing pages back would split
+ *                        them, so bloom_reset() clears large filters with
+ *                        several threads instead.
+ *
+ */
+enum bloom_alloc {
+  BLOOM_ALLOC_HEAP = 0,
+  BLOOM_ALLOC_MMAP = 1,
+  BLOOM_ALLOC_HUGE = 2
+};
+
+/** ***************************************************************************
+ * As bloom_init_sizing(), with the bit field allocated as `alloc` (enum
+ * bloom_alloc). bloom_free() releases it either way.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (including an unknown sizing or allocation, or no
+ *         anonymous mmap() on this platform)
+ *
+ */
+int bloom_init_alloc(struct bloom *bloom, size_t entries, double error,
+                     int sizing, int alloc);
+
+/** ***************************************************************************
+ * As bloom_init_wo_allocation(), with the bit field sized by `sizing`.
+ *
+ */
+void bloom_init_wo_allocation_sizing(struct bloom *bloom, size_t entries,
+                                     double error, int sizing);
+
 /** ***************************************************************************
  * Deprecated, use bloom_init()
  *
@@ -147,6 +249,147 @@ int bloom_check_ns(struct bloom *bloom, const void *buffer, int len);
  */
 int bloom_add(struct bloom *bloom, const void *buffer, int len);
 void bloom_add_ns(struct bloom *bloom, const void *buffer, int len);
+/** ***************************************************************************
+ * Add the given element to the bloom filter. Unlike bloom_add_ns(), several
+ * threads may call this concurrently on the same filter: bits are set with
+ * atomic read-modify-write operations, so no insert can be lost. Bits which
+ * are already set are not written, so adding keys which are mostly present
+ * does not bounce cache lines between cores.
+ *
+ * Concurrent bloom_check_ns() callers see each bit either set or not yet
+ * set; a key is guaranteed to be found once the bloom_add_atomic() call
+ * which added it has returned (and the caller synchronized with it).
+ *
+ * Parameters:
+ * -----------
+ *     bloom  - Pointer to an allocated struct bloom (see above).
+ *     buffer - Pointer to buffer containing element to add.
+ *     len    - Size of 'buffer'.
+ *
+ */
+void bloom_add_atomic(struct bloom *bloom, const void *buffer, int len);
+
+/** ***************************************************************************
+ * Add `n` elements of `len` bytes each, stored contiguously at `keys`.
+ *
+ * Same result as calling bloom_add_ns() for every element, but faster for
+ * large batches into filters much larger than the CPU caches: the bit
+ * positions of a batch of elements are hashed first, sorted by region of
+ * the bit field (256 KiB or more, so about an L2 cache) and then set region
+ * by region while the region is cached, instead of k cache misses per
+ * element. Filters under 4 MiB and small batches are added element by
+ * element.
+ *
+ * bloom_add_many_atomic() sets the bits as bloom_add_atomic() does, so
+ * several threads can bulk load the same filter, each with its own keys.
+ *
+ * Parameters:
+ * -----------
+ *     bloom  - Pointer to an allocated struct bloom (see above).
+ *     keys   - Pointer to the `n` elements.
+ *     len    - Size of every element.
+ *     n      - Number of elements.
+ *
+ */
+void bloom_add_many(struct bloom *bloom, const void *keys, int len,
+                    size_t n);
+void bloom_add_many_atomic(struct bloom *bloom, const void *keys, int len,
+                           size_t n);
+
+/** ***************************************************************************
+ * The hashes of one element, computed once with bloom_hash_key() and usable
+ * with every filter of the same hash function and seed, whatever its size:
+ * checking a key against many such filters hashes it only once.
+ *
+ */
+struct bloom_key_hash {
+  uint64_t a;             // hash(key, seed)
+  uint64_t b;             // hash(key, a)
+  unsigned int seed;
+  int hash_id;
+};
+
+/** ***************************************************************************
+ * Hash the given element with the hash function and seed of `bloom`.
+ *
+ * Parameters:
+ * -----------
+ *     bloom  - Pointer to an initialized struct bloom.
+ *     buffer - Pointer to buffer containing the element.
+ *     len    - Size of 'buffer'.
+ *     out    - Receives the hashes.
+ *
+ */
+void bloom_hash_key(const struct bloom *bloom, const void *buffer, int len,
+                    struct bloom_key_hash *out);
+
+/** ***************************************************************************
+ * Same as bloom_add_ns() and bloom_check_ns(), for an element hashed with
+ * bloom_hash_key().
+ *
+ * Return:
+ * -------
+ *     bloom_add_hash():    0 - element was added
+ *     bloom_check_hash():  0 - element is not present
+ *                          1 - element is present (or false positive)
+ *    -1 - `hash` was computed with another hash function or seed
+ *
+ */
+int bloom_add_hash(struct bloom *bloom, const struct bloom_key_hash *hash);
+int bloom_check_hash(struct bloom *bloom, const struct bloom_key_hash *hash);
+
+/** ***************************************************************************
+ * Check one hashed element against `n` filters. The first probed bit of
+ * every filter is prefetched before any filter is checked, so the cache
+ * misses of the filters overlap.
+ *
+ * Parameters:
+ * -----------
+ *     blooms  - The filters; all must use the hash function and seed of
+ *               `hash`.
+ *     n       - Number of filters.
+ *     hash    - The element, see bloom_hash_key().
+ *     results - Receives bloom_check_hash() of every filter.
+ *
+ * Return:
+ * -------
+ *     number of filters which contain the element
+ *
+ */
+size_t bloom_check_hash_many(struct bloom *const *blooms, size_t n,
+                             const struct bloom_key_hash *hash,
+                             int *results);
+
+/** ***************************************************************************
+ * Select the hash function of this bloom filter (enum bloom_hash). New
+ * filters use murmur2, or the hash chosen at build time with USE_WYHASH or
+ * USE_XXHASH. The hash must be chosen before the first element is added:
+ * elements added with another hash are no longer found.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (unknown hash, or not compiled in)
+ *
+ */
+int bloom_set_hash(struct bloom *bloom, int hash_id);
+
+/** ***************************************************************************
+ * Whether the hash `hash_id` (enum bloom_hash) is compiled in, and its name
+ * ("murmur2", "wyhash", "xxh3"; "unknown" for ids out of range).
+ *
+ */
+int bloom_hash_available(int hash_id);
+const char *bloom_hash_name(int hash_id);
+
+/** ***************************************************************************
+ * The function behind hash `hash_id`, NULL if not compiled in. A filter
+ * computes a = fn(key, len, seed) and b = fn(key, len, a), and probes bits
+ * (a + i * b) % bits for i < hashes.
+ *
+ */
+bloom_hash_fn bloom_hash_function(int hash_id);
+
 /** ***************************************************************************
  * Print (to stdout) info about this bloom filter. Debugging aid.
  *
@@ -172,7 +415,8 @@ void bloom_free(struct bloom *bloom);
  * Erase internal storage.
  *
  * Erases all elements. Upon return, the bloom struct returns to its initial
- * (initialized) state.
+ * (initialized) state. How long this takes depends on the allocation, see
+ * enum bloom_alloc.
  *
  * Parameters:
  * -----------
@@ -185,6 +429,265 @@ void bloom_free(struct bloom *bloom);
  */
 int bloom_reset(struct bloom *bloom);
 
+/** ***************************************************************************
+ * Shrink a filter sized to a power of two (BLOOM_SIZING_POW2) by `factor`,
+ * ORing the `factor` equal parts of its bit field into the first one.
+ *
+ * Every bit is indexed as x & mask, so bit x of the folded filter is
+ * x & (mask / factor): the OR of the bits which it replaces. Every key added
+ * before still tests positive, keys can still be added, and the false
+ * positive rate rises to that given by bloom_fold_fpr(). Entries and error
+ * keep their original (design) values.
+ *
+ * Parameters:
+ * -----------
+ *     bloom  - Pointer to an allocated struct bloom (see above).
+ *     factor - A power of two, at least 2; the folded filter must keep
+ *              BLOOM_MIN_POW2_BITS bits or more.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (filter not sized to a power of two, bad factor)
+ *
+ */
+int bloom_fold(struct bloom *bloom, unsigned int factor);
+
+/** ***************************************************************************
+ * Estimated false positive rate, fill ratio ^ hashes, of the filter
+ * bloom_fold(bloom, factor) would make, without changing the filter.
+ *
+ * Return:
+ * -------
+ *     the estimate, or -1 if the filter cannot be folded by `factor`
+ *
+ */
+double bloom_fold_fpr(const struct bloom *bloom, unsigned int factor);
+
+/** ***************************************************************************
+ * Number of bytes needed to serialize this bloom filter with
+ * bloom_serialize().
+ *
+ * The serialized format is a fixed 48-byte little-endian header (magic,
+ * format version, hash id, entries, error, bits, hashes, seed and byte
+ * count) followed by the raw bit field. Filters hashed with murmur2 are
+ * written as format version 1, which readers before version 2 can load;
+ * other hashes, and filters sized to a power of two (flagged in the high
+ * byte of the hash id), need version 2. It does not depend on the host byte order,
+ * so it can be shipped between hosts. See bloom_serialize_compressed() for
+ * a smaller form.
+ *
+ */
+size_t bloom_serialized_size(const struct bloom *bloom);
+
+/** ***************************************************************************
+ * Serialize the bloom filter into a caller-supplied buffer.
+ *
+ * Parameters:
+ * -----------
+ *     bloom  - Pointer to an initialized struct bloom.
+ *     buffer - Destination buffer.
+ *     len    - Size of 'buffer', at least bloom_serialized_size(bloom).
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (bloom not initialized or buffer too small)
+ *
+ */
+int bloom_serialize(const struct bloom *bloom, void *buffer, size_t len);
+
+/** ***************************************************************************
+ * Initialize a bloom filter from a buffer written by bloom_serialize().
+ *
+ * The parameters stored in the header are re-derived with
+ * bloom_init_wo_allocation() and must agree with the stored ones, so a
+ * truncated or corrupted buffer is rejected rather than producing a filter
+ * with a bogus shape. On success the struct owns a freshly allocated bit
+ * field and must be released with bloom_free().
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_deserialize(struct bloom *bloom, const void *buffer, size_t len);
+
+/** ***************************************************************************
+ * Codecs of bloom_serialize_compressed(). RAW is the bit field as is; RICE
+ * Golomb-Rice codes the gaps between set bits, which takes a fraction of
+ * the raw size for lightly loaded filters (about 0.15 of it at a fill
+ * ratio of 1%, 0.5 at 10%). AUTO picks RICE when it is estimated to be
+ * smaller, from the fill ratio.
+ *
+ */
+enum bloom_codec {
+  BLOOM_CODEC_AUTO = -1,
+  BLOOM_CODEC_RAW = 0,
+  BLOOM_CODEC_RICE = 1
+};
+
+/** ***************************************************************************
+ * Maximum output size of bloom_serialize_compressed().
+ *
+ */
+size_t bloom_compressed_bound(const struct bloom *bloom);
+
+/** ***************************************************************************
+ * Serialize the bloom filter, compressed, into a caller-supplied buffer.
+ * The output (format version 3) is read by bloom_deserialize(), which
+ * handles both forms. If RICE turns out no smaller than RAW, RAW is
+ * written instead.
+ *
+ * Parameters:
+ * -----------
+ *     bloom   - Pointer to an initialized struct bloom.
+ *     codec   - enum bloom_codec.
+ *     buffer  - Destination buffer.
+ *     len     - Size of 'buffer', at least bloom_compressed_bound(bloom).
+ *     written - Receives the number of bytes written.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (bloom not initialized, unknown codec or buffer too
+ *         small)
+ *
+ */
+int bloom_serialize_compressed(const struct bloom *bloom, int codec,
+                               void *buffer, size_t len, size_t *written);
+
+/** ***************************************************************************
+ * Checksum (64-bit wyhash) of the bit field, e.g. for replicas to compare
+ * their copies of a filter.
+ *
+ */
+uint64_t bloom_checksum(const struct bloom *bloom);
+
+/** ***************************************************************************
+ * Delta between two versions of a filter, to bring replicas up to date
+ * without shipping the whole bit field.
+ *
+ * bloom_diff() scans the two bit fields word by word and Rice codes the
+ * positions of the bits that differ (see bloom_serialize_compressed()), so
+ * the delta grows with the number of changed bits rather than the filter
+ * size. The delta carries its format version, the filter shape and the
+ * checksums of both versions: bloom_apply_delta() rejects a delta unless
+ * the filter it is applied to is exactly `older`, and checks the result
+ * against `bloom`.
+ *
+ * Parameters:
+ * -----------
+ *     bloom   - The current version.
+ *     older   - The version the replica has; same shape as `bloom`.
+ *     buffer  - Destination buffer.
+ *     len     - Size of 'buffer', at least bloom_delta_bound(bloom).
+ *     written - Receives the number of bytes written.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (not initialized, shapes differ or buffer too small),
+ *         or for bloom_apply_delta(): the delta is corrupted or does not
+ *         apply to this filter; the filter is left unchanged
+ *
+ */
+size_t bloom_delta_bound(const struct bloom *bloom);
+int bloom_diff(const struct bloom *bloom, const struct bloom *older,
+               void *buffer, size_t len, size_t *written);
+int bloom_apply_delta(struct bloom *bloom, const void *delta, size_t len);
+
+/** ***************************************************************************
+ * Runtime statistics (opt-in).
+ *
+ * Once enabled, every add and lookup through the functions above is counted,
+ * together with the number of bits a lookup probed before it could answer
+ * (lookups of absent keys usually stop after one or two probes, positives
+ * probe all `hashes` bits). Counters are sharded by thread, each shard on
+ * its own cache lines, so threads do not contend on them; a snapshot sums
+ * the shards. A filter without statistics pays one predictable branch per
+ * operation.
+ *
+ * Statistics are released by bloom_free(). bloom_init() and
+ * bloom_deserialize() start without statistics.
+ *
+ */
+#define BLOOM_STATS_SHARDS 16
+#define BLOOM_STATS_PROBE_BUCKETS 16
+
+struct bloom_stats_snapshot {
+  uint64_t adds;
+  uint64_t lookups;
+  uint64_t positives;     // lookups which returned 1
+  uint64_t probes;        // bits probed by all lookups
+  // probe_depth[i]: lookups which probed i + 1 bits; the last bucket also
+  // counts deeper lookups.
+  uint64_t probe_depth[BLOOM_STATS_PROBE_BUCKETS];
+  double fill_ratio;      // fraction of the bits set
+  double estimated_fpr;   // fill_ratio ^ hashes
+};
+
+/** ***************************************************************************
+ * Start collecting statistics on this bloom filter (counters start at 0;
+ * enabling twice keeps the existing counters).
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (bloom not initialized or out of memory)
+ *
+ */
+int bloom_stats_enable(struct bloom *bloom);
+
+/** ***************************************************************************
+ * Stop collecting statistics and release them. Must not run concurrently
+ * with other operations on the filter.
+ *
+ */
+void bloom_stats_disable(struct bloom *bloom);
+
+/** ***************************************************************************
+ * Sum the counters of all shards into `out` and compute the fill ratio and
+ * estimated false positive rate of the current bitmap (a popcount of the
+ * whole bitmap, so O(bytes)). May run concurrently with adds and lookups;
+ * the counters are then a consistent-enough approximation.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - statistics are not enabled
+ *
+ */
+int bloom_stats_get(const struct bloom *bloom,
+                    struct bloom_stats_snapshot *out);
+
+/** ***************************************************************************
+ * Write a snapshot in the Prometheus text exposition format (metrics
+ * bloom_adds_total, bloom_lookups_total, bloom_positives_total,
+ * bloom_probe_depth histogram, bloom_fill_ratio, bloom_estimated_fpr and
+ * bloom_size_bytes), labelled with filter="`name`".
+ *
+ * bloom_stats_format() writes into `buffer` like snprintf(): it returns the
+ * length of the complete text, which was truncated if it is >= `len`, or 0
+ * if statistics are not enabled.
+ * bloom_stats_write() writes to a stream (a file or a socket opened with
+ * fdopen()). bloom_stats_export() replaces the file at `path` atomically
+ * (write to a temporary file, then rename), so a scraper never reads a
+ * partial file.
+ *
+ * Return:
+ * -------
+ *     0 - on success (bloom_stats_write() and bloom_stats_export())
+ *     1 - on failure, including statistics not enabled
+ *
+ */
+size_t bloom_stats_format(const struct bloom *bloom, const char *name,
+                          char *buffer, size_t len);
+int bloom_stats_write(const struct bloom *bloom, const char *name, FILE *out);
+int bloom_stats_export(const struct bloom *bloom, const char *name,
+                       const char *path);
+
 /** ***************************************************************************
  * Returns version string compiled into library.
  *
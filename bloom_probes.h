@@ -0,0 +1,47 @@
+/*
+ * USDT (SystemTap / DTrace compatible) static tracepoints of provider
+ * "libbloom", for bpftrace, perf and SystemTap. See misc/bpftrace for an
+ * example.
+ *
+ * A probe compiles to a single nop plus an ELF note; nothing runs unless a
+ * tracer is attached. Without <sys/sdt.h> (systemtap-sdt-dev on Debian,
+ * systemtap-sdt-devel on Fedora), or with BLOOM_NO_PROBES defined, the
+ * probes compile to nothing.
+ *
+ * Probes and arguments:
+ *     init              (bloom, entries, bytes)
+ *     free              (bloom)
+ *     reset             (bloom)
+ *     add__start        (bloom, len)
+ *     add__done         (bloom, len, result)   result -1 if not computed
+ *     check__start      (bloom, len)
+ *     check__done       (bloom, len, result)
+ *                                              len 0 for precomputed hashes
+ *     add_many__start   (bloom, n)             C++ wrapper
+ *     add_many__done    (bloom, n)
+ *     merge             (bloom, other)         C++ wrapper
+ *     save              (bloom, len, result)   bloom_serialize()
+ *     load              (bloom, len, result)   bloom_deserialize()
+ */
+
+#ifndef BLOOM_PROBES_H
+#define BLOOM_PROBES_H
+
+#if !defined(BLOOM_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BLOOM_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef BLOOM_HAVE_PROBES
+#define BLOOM_PROBE1(name, a) DTRACE_PROBE1(libbloom, name, a)
+#define BLOOM_PROBE2(name, a, b) DTRACE_PROBE2(libbloom, name, a, b)
+#define BLOOM_PROBE3(name, a, b, c) DTRACE_PROBE3(libbloom, name, a, b, c)
+#else
+#define BLOOM_PROBE1(name, a) ((void) 0)
+#define BLOOM_PROBE2(name, a, b) ((void) 0)
+#define BLOOM_PROBE3(name, a, b, c) ((void) 0)
+#endif
+
+#endif
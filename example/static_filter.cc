@@ -0,0 +1,15 @@
+// Look names up in a bloom filter generated from example/blocklist.txt at
+// build time (bloom_embed_filter() in CMakeLists.txt): nothing is built at
+// startup, the bitmap is part of the binary.
+#include "blocklist.h"
+#include <iostream>
+#include <string>
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    std::cout << argv[i] << ": "
+              << (blocklist.contains(std::string(argv[i])) ? "blocked"
+                                                           : "allowed")
+              << std::endl;
+  }
+}
@@ -5,6 +5,8 @@
  *  This file is under BSD license. See LICENSE file.
  */
 
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <fcntl.h>
 #include <inttypes.h>
@@ -19,6 +21,7 @@
 #include <unistd.h>
 
 #include "bloom.h"
+#include "benchmark/perf_counters.h"
 
 #ifdef __linux
 #include <sys/time.h>
@@ -26,17 +29,18 @@
 #endif
 
 
-uint64_t get_current_time_millis()
+uint64_t get_current_time_nanos()
 {
-  struct timeval tp;
-  gettimeofday(&tp, NULL);
-  return (tp.tv_sec * 1000L) + (tp.tv_usec / 1000L);
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (tp.tv_sec * 1000000000L) + tp.tv_nsec;
 }
 
 void add_and_test(size_t entries, double error, uint64_t count,
                   char test_known_added)
 {
   struct bloom bloom;
+  struct perf_counters pc;
   uint64_t n, initial, found = 0;
   int collisions = 0;
   int rv;
@@ -47,8 +51,10 @@ void add_and_test(size_t entries, double error, uint64_t count,
   initial = n;
 
   assert(bloom_init(&bloom, entries, error) == 0);
+  perf_counters_open(&pc);
 
-  uint64_t t1 = get_current_time_millis();
+  perf_counters_start(&pc);
+  uint64_t t1 = get_current_time_nanos();
 
   n = initial;
   for (uint64_t c = 0; c < count; c++) {
@@ -56,8 +62,12 @@ void add_and_test(size_t entries, double error, uint64_t count,
     n++;
   }
 
-  uint64_t t2 = get_current_time_millis();
+  uint64_t t2 = get_current_time_nanos();
+  perf_counters_stop(&pc);
+  perf_counters_print(&pc, stdout, "ADD", count);
 
+  perf_counters_start(&pc);
+  uint64_t t3 = get_current_time_nanos();
   if (test_known_added) { n = initial; }
 
   for (uint64_t c = 0; c < count; c++) {
@@ -67,13 +77,17 @@ void add_and_test(size_t entries, double error, uint64_t count,
     found += rv;
   }
 
-  uint64_t t3 = get_current_time_millis();
+  uint64_t t4 = get_current_time_nanos();
+  perf_counters_stop(&pc);
+  perf_counters_print(&pc, stdout, "CHECK", count);
+  perf_counters_close(&pc);
 
   double pct = (double)collisions / (double)entries;
 
   printf("add_and_test: %10lu (%1.4f): %8d collisions (%1.4f), %10" PRIu64
-         " found; ADD: %6" PRIu64 " ms, CHECK: %6" PRIu64 " ms\n",
-         entries, error, collisions, pct, found, (t2-t1), (t3-t2));
+         " found; ADD: %9.3f ms, CHECK: %9.3f ms\n",
+         entries, error, collisions, pct, found, (t2-t1) / 1e6,
+         (t4-t3) / 1e6);
 }
 
 
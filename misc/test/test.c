@@ -23,6 +23,9 @@
 #include <time.h>
 #endif
 
+/* Hash of the filters under test (-H), -1 for the library default. */
+static int hash_id = -1;
+
 
 /** ***************************************************************************
  * A few simple tests to check if it works at all.
@@ -74,6 +77,7 @@ static int add_random(int entries, double error, int count,
 
   struct bloom bloom;
   assert(bloom_init(&bloom, entries, error) == 0);
+  if (hash_id >= 0) { assert(bloom_set_hash(&bloom, hash_id) == 0); }
   if (!quiet) { bloom_print(&bloom); }
   assert(bloom_reset(&bloom) == 0);
 
@@ -147,6 +151,7 @@ static int perf_loop(int entries, int count)
 
   struct bloom bloom;
   assert(bloom_init(&bloom, entries, 0.001) == 0);
+  if (hash_id >= 0) { assert(bloom_set_hash(&bloom, hash_id) == 0); }
   bloom_print(&bloom);
 
   int i;
@@ -239,6 +244,10 @@ static int larger_tests()
  * Where 'ENTRIES' is the expected number of entries used to initialize the
  * bloom filter and 'COUNT' is the actual number of entries inserted.
  *
+ * Any of the above may be preceded by -H HASH to build the filters with
+ * another hash function (murmur2, wyhash or xxh3), e.g. to compare the
+ * collision rates of two hashes with -G.
+ *
  */
 int main(int argc, char **argv)
 {
@@ -248,6 +257,18 @@ int main(int argc, char **argv)
 
   int rv = 0;
 
+  if (argc >= 3 && !strncmp(argv[1], "-H", 2)) {
+    for (hash_id = 0; hash_id < BLOOM_HASH_COUNT; hash_id++) {
+      if (!strcmp(argv[2], bloom_hash_name(hash_id))) { break; }
+    }
+    if (!bloom_hash_available(hash_id)) {
+      printf("hash function not available: %s\n", argv[2]);
+      return 1;
+    }
+    argv += 2;
+    argc -= 2;
+  }
+
   if (argc == 1) {
     printf("----- Running basic tests -----\n");
     rv = basic_tests();
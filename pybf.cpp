@@ -1,217 +1,608 @@
-#include "bloom.h"
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <fcntl.h>
+#include <pythread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <new>
+#include <stdexcept>
+
+#include "BloomFilter.h"
 
 static char bloom_doc[] = "Python wrapping for libbloom, a simple and small "
                           "bloom filter implementation in C";
 
 /*
- * Exported Methods declarations
+ * The filter object.
+ *
+ * `lock` serializes writers to the bitmap. Operations which may take a while
+ * (batch insert, merge, popcount, serialization) run with the GIL released,
+ * so a writer must hold `lock` even when it holds the GIL, otherwise a
+ * single-key add could race with a batch insert running in another thread
+ * and lose bits. Readers never take it.
  */
-static PyObject *wrapper_init(PyObject *self, PyObject *args);
-static PyObject *wrapper_check(PyObject *self, PyObject *args);
-static PyObject *wrapper_add(PyObject *self, PyObject *args);
-static PyObject *wrapper_check_str(PyObject *self, PyObject *args);
-static PyObject *wrapper_add_str(PyObject *self, PyObject *args);
-static PyObject *wrapper_free(PyObject *self, PyObject *args);
-static PyObject *wrapper_print(PyObject *self, PyObject *args);
-static PyObject *wrapper_size(PyObject *self, PyObject *args);
-static PyObject *wrapper_num_hash(PyObject *self, PyObject *args);
-static PyObject *wrapper_error(PyObject *self, PyObject *args);
-static PyObject *wrapper_set_seed(PyObject *self, PyObject *args);
-
-static PyObject *wrapper_num_set_bits(PyObject *self, PyObject *args);
-static PyObject *wrapper_fpr(PyObject *self, PyObject *args);
-
-/*
- * Methods exported by this module
- */
-static PyMethodDef bloom_methods[] = {
-    {"init", wrapper_init, METH_VARARGS},
-    {"check", wrapper_check, METH_VARARGS},
-    {"add", wrapper_add, METH_VARARGS},
-    {"check_str", wrapper_check_str, METH_VARARGS},
-    {"add_str", wrapper_add_str, METH_VARARGS},
-    {"free", wrapper_free, METH_VARARGS},
-    {"size", wrapper_size, METH_VARARGS},
-    {"num_hash", wrapper_num_hash, METH_VARARGS},
-    {"error", wrapper_error, METH_VARARGS},
-    {"print", wrapper_print, METH_VARARGS},
-    {"set_seed", wrapper_set_seed, METH_VARARGS},
-    {"num_set_bits", wrapper_num_set_bits, METH_VARARGS},
-    {"fpr", wrapper_fpr, METH_VARARGS},
-    {NULL, NULL} /* Sentinel */
-};
+typedef struct {
+  PyObject_HEAD
+  BloomFilter *bf;
+  PyThread_type_lock lock;
+} PyBloomFilter;
+
+// Slots are filled in by PyInit_bloom().
+static PyTypeObject PyBloomFilter_Type = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+static void lock_filter(PyBloomFilter *self) {
+  if (!PyThread_acquire_lock(self->lock, NOWAIT_LOCK)) {
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+  }
+}
 
-#if PY_MAJOR_VERSION >= 3
-/* ! the struct name must respect the format: <name of the module> followed by
- * string "module"*/
-static struct PyModuleDef bloommodule = {
-    PyModuleDef_HEAD_INIT, "bloom", /* name of module */
-    bloom_doc,                      /* module documentation, may be NULL */
-    -1, /* size of per-interpreter state of the module,
-           or -1 if the module keeps state in global variables. */
-    bloom_methods};
-#endif
+static void unlock_filter(PyBloomFilter *self) {
+  PyThread_release_lock(self->lock);
+}
 
 /*
- * Module initialization
+ * Key handling: ints are hashed as 64-bit unsigned integers (anything
+ * implementing __index__, e.g. numpy integers, is accepted), str as its
+ * UTF-8 encoding and any other object through the buffer protocol.
  */
-#if PY_MAJOR_VERSION >= 3
-PyMODINIT_FUNC PyInit_bloom(void)
-#else
-PyMODINIT_FUNC initbloom(void)
-#endif
-{
-#if PY_MAJOR_VERSION >= 3
-  return PyModule_Create(&bloommodule);
-#else
-  (void)Py_InitModule("bloom", bloom_methods);
-#endif
+typedef struct {
+  const char *data;
+  Py_ssize_t len;
+  unsigned long long value;
+  Py_buffer view;
+  int has_view;
+} key_buffer;
+
+static int key_acquire(PyObject *key, key_buffer *kb) {
+  kb->has_view = 0;
+  if (PyUnicode_Check(key)) {
+    kb->data = PyUnicode_AsUTF8AndSize(key, &kb->len);
+    return kb->data == NULL ? -1 : 0;
+  }
+  if (PyIndex_Check(key)) {
+    PyObject *index = PyNumber_Index(key);
+    if (index == NULL)
+      return -1;
+    kb->value = PyLong_AsUnsignedLongLongMask(index);
+    Py_DECREF(index);
+    if (kb->value == (unsigned long long)-1 && PyErr_Occurred())
+      return -1;
+    kb->data = (const char *)&kb->value;
+    kb->len = sizeof(kb->value);
+    return 0;
+  }
+  if (PyObject_CheckBuffer(key)) {
+    if (PyObject_GetBuffer(key, &kb->view, PyBUF_SIMPLE) != 0)
+      return -1;
+    kb->has_view = 1;
+    kb->data = (const char *)kb->view.buf;
+    kb->len = kb->view.len;
+    return 0;
+  }
+  PyErr_Format(PyExc_TypeError, "unsupported key type: %.200s",
+               Py_TYPE(key)->tp_name);
+  return -1;
+}
+
+static void key_release(key_buffer *kb) {
+  if (kb->has_view)
+    PyBuffer_Release(&kb->view);
 }
 
 /*
- * Methods definition
+ * Type methods
  */
+static PyObject *BloomFilter_new(PyTypeObject *type, PyObject *args,
+                                 PyObject *kwds) {
+  PyBloomFilter *self = (PyBloomFilter *)type->tp_alloc(type, 0);
+  if (self == NULL)
+    return NULL;
+  self->bf = NULL;
+  self->lock = PyThread_allocate_lock();
+  if (self->lock == NULL) {
+    Py_DECREF(self);
+    return PyErr_NoMemory();
+  }
+  return (PyObject *)self;
+}
 
-PyObject *wrapper_init(PyObject *self, PyObject *args) {
-  int items = 0;
+static int BloomFilter_init(PyBloomFilter *self, PyObject *args,
+                            PyObject *kwds) {
+  static const char *kwlist[] = {"entries", "error", "seed", "hash", NULL};
+  Py_ssize_t entries = 0;
   double error = 0.0;
-  if (!PyArg_ParseTuple(args, "id", &items, &error))
-    Py_RETURN_NONE;
+  unsigned int seed = 0;
+  const char *hash_name = NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "nd|Iz", (char **)kwlist,
+                                   &entries, &error, &seed, &hash_name))
+    return -1;
+  if (self->bf != NULL) {
+    // the filter may be in use by another thread or by an exported buffer
+    PyErr_SetString(PyExc_RuntimeError, "BloomFilter already initialized");
+    return -1;
+  }
+  if (entries <= 0) {
+    PyErr_SetString(PyExc_ValueError, "entries must be positive");
+    return -1;
+  }
+  int hash = -1;
+  for (int id = 0; hash_name != NULL && id < BLOOM_HASH_COUNT; ++id) {
+    if (strcmp(hash_name, bloom_hash_name(id)) == 0 &&
+        bloom_hash_available(id))
+      hash = id;
+  }
+  if (hash_name != NULL && hash < 0) {
+    PyErr_Format(PyExc_ValueError, "hash function not available: %s",
+                 hash_name);
+    return -1;
+  }
+
+  try {
+    self->bf = hash < 0 ? new BloomFilter(entries, error, seed)
+                        : new BloomFilter(entries, error, (bloom_hash) hash,
+                                          seed);
+  } catch (const std::bad_alloc &) {
+    PyErr_NoMemory();
+    return -1;
+  } catch (const std::exception &e) {
+    PyErr_SetString(PyExc_ValueError, e.what());
+    return -1;
+  }
+  return 0;
+}
 
-  struct bloom *bf = new bloom();
-  bloom_init(bf, items, error);
-  return Py_BuildValue("l", bf);
+static void BloomFilter_dealloc(PyBloomFilter *self) {
+  delete self->bf;
+  if (self->lock != NULL)
+    PyThread_free_lock(self->lock);
+  Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
-static PyObject *wrapper_check(PyObject *self, PyObject *args) {
-  size_t key;
-  int len;
-  struct bloom *bf;
-  int ret;
-  if (!PyArg_ParseTuple(args, "lk", &bf, &key))
-    Py_RETURN_NONE;
+static int check_ready(PyBloomFilter *self) {
+  if (self->bf == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "BloomFilter not initialized");
+    return -1;
+  }
+  return 0;
+}
 
-  len = sizeof(key);
-  ret = bloom_check(bf, &key, len);
+static PyObject *BloomFilter_add(PyBloomFilter *self, PyObject *key) {
+  key_buffer kb;
+  if (check_ready(self) != 0 || key_acquire(key, &kb) != 0)
+    return NULL;
+  lock_filter(self);
+  self->bf->add(kb.data, kb.len);
+  unlock_filter(self);
+  key_release(&kb);
+  Py_RETURN_NONE;
+}
 
-  return Py_BuildValue("i", ret);
+static int BloomFilter_contains(PyBloomFilter *self, PyObject *key) {
+  key_buffer kb;
+  if (check_ready(self) != 0 || key_acquire(key, &kb) != 0)
+    return -1;
+  int ret = self->bf->contains(kb.data, kb.len);
+  key_release(&kb);
+  return ret;
 }
 
-static PyObject *wrapper_check_str(PyObject *self, PyObject *args) {
-  int len;
-  struct bloom *bf;
-  int ret;
-  char *str;
-  if (!PyArg_ParseTuple(args, "lsi", &bf, &str, &len))
-    Py_RETURN_NONE;
-  ret = bloom_check(bf, str, len);
+static PyObject *BloomFilter_add_many(PyBloomFilter *self, PyObject *arg) {
+  Py_buffer view;
+  if (check_ready(self) != 0 ||
+      PyObject_GetBuffer(arg, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+    return NULL;
+
+  // Integer keys are hashed as 64-bit values (see `add`), so only 8-byte
+  // integer arrays can be inserted without a conversion pass.
+  const char *fmt = view.format == NULL ? "B" : view.format;
+  if (*fmt == '@' || *fmt == '=' || *fmt == '<')
+    fmt++;
+  if (view.itemsize != 8 || fmt[1] != '\0' || strchr("qQlLnN", *fmt) == NULL) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_TypeError,
+                    "add_many() expects a contiguous buffer of 64-bit "
+                    "integers");
+    return NULL;
+  }
+
+  const uint64_t *keys = (const uint64_t *)view.buf;
+  size_t n = (size_t)(view.len / view.itemsize);
+  lock_filter(self);
+  Py_BEGIN_ALLOW_THREADS
+  self->bf->add_many(keys, n);
+  Py_END_ALLOW_THREADS
+  unlock_filter(self);
+  PyBuffer_Release(&view);
+  Py_RETURN_NONE;
+}
 
-  return Py_BuildValue("i", ret);
+static PyObject *BloomFilter_add_iter(PyBloomFilter *self, PyObject *arg) {
+  if (check_ready(self) != 0)
+    return NULL;
+  PyObject *it = PyObject_GetIter(arg);
+  if (it == NULL)
+    return NULL;
+
+  // Keys are hashed straight out of the bytes object or the cached UTF-8
+  // representation of the str; nothing is encoded into a temporary. The
+  // lock is taken per key since the iterator may run arbitrary Python code.
+  size_t count = 0;
+  PyObject *key;
+  while ((key = PyIter_Next(it)) != NULL) {
+    key_buffer kb;
+    if (key_acquire(key, &kb) != 0) {
+      Py_DECREF(key);
+      break;
+    }
+    lock_filter(self);
+    self->bf->add(kb.data, kb.len);
+    unlock_filter(self);
+    key_release(&kb);
+    Py_DECREF(key);
+    count++;
+  }
+  Py_DECREF(it);
+  if (PyErr_Occurred())
+    return NULL;
+  return PyLong_FromSize_t(count);
 }
 
-static PyObject *wrapper_add(PyObject *self, PyObject *args) {
-  size_t key;
-  int len;
-  struct bloom *bf;
-  int ret;
-  if (!PyArg_ParseTuple(args, "lk", &bf, &key))
-    Py_RETURN_NONE;
+/*
+ * Insert every non-empty record of `data` separated by `sep`. Runs without
+ * the GIL.
+ */
+static size_t add_records(BloomFilter *bf, const char *data, size_t len,
+                          const char *sep, size_t sep_len) {
+  size_t count = 0;
+  const char *p = data, *end = data + len;
+  while (p < end) {
+    const char *q;
+    if (sep_len == 1)
+      q = (const char *)memchr(p, *sep, end - p);
+    else
+      q = (const char *)memmem(p, end - p, sep, sep_len);
+    if (q == NULL)
+      q = end;
+    if (q > p) {
+      bf->add(p, q - p);
+      count++;
+    }
+    p = q + sep_len;
+  }
+  return count;
+}
 
-  len = sizeof(key);
-  ret = bloom_add(bf, &key, len);
-  return Py_BuildValue("i", ret);
+static PyObject *BloomFilter_add_file(PyBloomFilter *self, PyObject *args,
+                                      PyObject *kwds) {
+  static const char *kwlist[] = {"path", "sep", NULL};
+  PyObject *path = NULL;
+  const char *sep = "\n";
+  Py_ssize_t sep_len = 1;
+  if (check_ready(self) != 0 ||
+      !PyArg_ParseTupleAndKeywords(args, kwds, "O&|y#", (char **)kwlist,
+                                   PyUnicode_FSConverter, &path, &sep,
+                                   &sep_len))
+    return NULL;
+  if (sep_len == 0) {
+    Py_DECREF(path);
+    PyErr_SetString(PyExc_ValueError, "empty separator");
+    return NULL;
+  }
+
+  int fd = open(PyBytes_AS_STRING(path), O_RDONLY);
+  if (fd < 0) {
+    PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+    Py_DECREF(path);
+    return NULL;
+  }
+  Py_DECREF(path);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    // raise before close() can clobber errno
+    PyErr_SetFromErrno(PyExc_OSError);
+    close(fd);
+    return NULL;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return PyLong_FromLong(0);
+  }
+
+  size_t len = (size_t)st.st_size;
+  void *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    PyErr_SetFromErrno(PyExc_OSError);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+  madvise(data, len, MADV_SEQUENTIAL);
+
+  size_t count;
+  lock_filter(self);
+  Py_BEGIN_ALLOW_THREADS
+  count = add_records(self->bf, (const char *)data, len, sep, sep_len);
+  Py_END_ALLOW_THREADS
+  unlock_filter(self);
+  munmap(data, len);
+  return PyLong_FromSize_t(count);
 }
 
-static PyObject *wrapper_add_str(PyObject *self, PyObject *args) {
-  int len;
-  struct bloom *bf;
-  int ret;
-  char *str;
-  if (!PyArg_ParseTuple(args, "lsi", &bf, &str, &len))
-    Py_RETURN_NONE;
-  ret = bloom_add(bf, str, len);
-  return Py_BuildValue("i", ret);
+static PyObject *BloomFilter_merge(PyBloomFilter *self, PyObject *arg) {
+  if (!PyObject_TypeCheck(arg, &PyBloomFilter_Type)) {
+    PyErr_SetString(PyExc_TypeError, "merge() expects a BloomFilter");
+    return NULL;
+  }
+  PyBloomFilter *other = (PyBloomFilter *)arg;
+  if (check_ready(self) != 0 || check_ready(other) != 0)
+    return NULL;
+
+  // both bitmaps are in use: lock them in address order, so that a.merge(b)
+  // and b.merge(a) in two threads cannot deadlock
+  PyBloomFilter *first = self < other ? self : other;
+  PyBloomFilter *second = self < other ? other : self;
+  int failed = 0;
+  lock_filter(first);
+  if (second != first)
+    lock_filter(second);
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    self->bf->merge(*other->bf);
+  } catch (const std::exception &) {
+    failed = 1;
+  }
+  Py_END_ALLOW_THREADS
+  if (second != first)
+    unlock_filter(second);
+  unlock_filter(first);
+  if (failed) {
+    PyErr_SetString(PyExc_ValueError, "Bloom filter shapes mismatch");
+    return NULL;
+  }
+  Py_RETURN_NONE;
 }
 
-static PyObject *wrapper_size(PyObject *self, PyObject *args) {
-  struct bloom *bf;
-  if (!PyArg_ParseTuple(args, "l", &bf))
-    Py_RETURN_NONE;
-  int ret = bf->bits;
-  return Py_BuildValue("i", ret);
+static PyObject *BloomFilter_popcount(PyBloomFilter *self,
+                                      PyObject *Py_UNUSED(ignored)) {
+  if (check_ready(self) != 0)
+    return NULL;
+  size_t count;
+  Py_BEGIN_ALLOW_THREADS
+  count = self->bf->popcount();
+  Py_END_ALLOW_THREADS
+  return PyLong_FromSize_t(count);
 }
 
-static PyObject *wrapper_num_hash(PyObject *self, PyObject *args) {
-  struct bloom *bf;
-  if (!PyArg_ParseTuple(args, "l", &bf))
-    Py_RETURN_NONE;
+static PyObject *BloomFilter_fpr(PyBloomFilter *self,
+                                 PyObject *Py_UNUSED(ignored)) {
+  if (check_ready(self) != 0)
+    return NULL;
+  double fpr;
+  Py_BEGIN_ALLOW_THREADS
+  fpr = self->bf->effective_fpp();
+  Py_END_ALLOW_THREADS
+  return PyFloat_FromDouble(fpr);
+}
 
-  int ret = bf->hashes;
-  return Py_BuildValue("i", ret);
+static PyObject *BloomFilter_reset(PyBloomFilter *self,
+                                   PyObject *Py_UNUSED(ignored)) {
+  if (check_ready(self) != 0)
+    return NULL;
+  lock_filter(self);
+  Py_BEGIN_ALLOW_THREADS
+  self->bf->reset();
+  Py_END_ALLOW_THREADS
+  unlock_filter(self);
+  Py_RETURN_NONE;
 }
 
-static PyObject *wrapper_error(PyObject *self, PyObject *args) {
-  struct bloom *bf;
-  if (!PyArg_ParseTuple(args, "l", &bf))
-    Py_RETURN_NONE;
+static PyObject *BloomFilter_num_hashes(PyBloomFilter *self,
+                                        PyObject *Py_UNUSED(ignored)) {
+  if (check_ready(self) != 0)
+    return NULL;
+  return PyLong_FromSize_t(self->bf->num_hashes());
+}
 
-  int ret = bf->error;
-  return Py_BuildValue("d", ret);
+static PyObject *BloomFilter_error(PyBloomFilter *self,
+                                   PyObject *Py_UNUSED(ignored)) {
+  if (check_ready(self) != 0)
+    return NULL;
+  return PyFloat_FromDouble(self->bf->error());
 }
 
-static PyObject *wrapper_free(PyObject *self, PyObject *args) {
-  struct bloom *bf;
-  if (!PyArg_ParseTuple(args, "l", &bf))
-    Py_RETURN_NONE;
+static PyObject *BloomFilter_seed(PyBloomFilter *self,
+                                  PyObject *Py_UNUSED(ignored)) {
+  if (check_ready(self) != 0)
+    return NULL;
+  return PyLong_FromUnsignedLong(self->bf->hash_seed());
+}
 
-  bloom_free(bf);
-  free(bf);
-  return Py_BuildValue("");
+static PyObject *BloomFilter_hash(PyBloomFilter *self,
+                                  PyObject *Py_UNUSED(ignored)) {
+  if (check_ready(self) != 0)
+    return NULL;
+  return PyUnicode_FromString(self->bf->hash_name());
 }
 
-static PyObject *wrapper_print(PyObject *self, PyObject *args) {
-  struct bloom *bf;
-  if (!PyArg_ParseTuple(args, "l", &bf))
-    Py_RETURN_NONE;
+static PyObject *BloomFilter_print(PyBloomFilter *self,
+                                   PyObject *Py_UNUSED(ignored)) {
+  if (check_ready(self) != 0)
+    return NULL;
+  self->bf->print();
+  Py_RETURN_NONE;
+}
 
-  bloom_print(bf);
+static PyObject *BloomFilter_serialize(PyBloomFilter *self,
+                                       PyObject *Py_UNUSED(ignored)) {
+  if (check_ready(self) != 0)
+    return NULL;
+  size_t len = self->bf->serialized_size();
+  PyObject *out = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)len);
+  if (out == NULL)
+    return NULL;
+  unsigned char *buf = (unsigned char *)PyBytes_AS_STRING(out);
+  Py_BEGIN_ALLOW_THREADS
+  self->bf->serialize(buf, len);
+  Py_END_ALLOW_THREADS
+  return out;
+}
 
-  return Py_BuildValue("");
+static PyObject *BloomFilter_deserialize(PyTypeObject *type, PyObject *arg) {
+  Py_buffer view;
+  if (PyObject_GetBuffer(arg, &view, PyBUF_SIMPLE) != 0)
+    return NULL;
+
+  PyBloomFilter *self = (PyBloomFilter *)BloomFilter_new(type, NULL, NULL);
+  if (self == NULL) {
+    PyBuffer_Release(&view);
+    return NULL;
+  }
+  int failed = 0;
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    self->bf = new BloomFilter(BloomFilter::deserialize(
+        (const unsigned char *)view.buf, (size_t)view.len));
+  } catch (const std::exception &) {
+    failed = 1;
+  }
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&view);
+  if (failed) {
+    Py_DECREF(self);
+    PyErr_SetString(PyExc_ValueError, "invalid serialized BloomFilter");
+    return NULL;
+  }
+  return (PyObject *)self;
 }
 
-static PyObject *wrapper_set_seed(PyObject *self, PyObject *args) {
-  struct bloom *bf;
-  unsigned int seed;
-  if (!PyArg_ParseTuple(args, "lI", &bf, &seed))
-    Py_RETURN_NONE;
+static PyObject *BloomFilter_reduce(PyBloomFilter *self,
+                                    PyObject *Py_UNUSED(ignored)) {
+  PyObject *data = BloomFilter_serialize(self, NULL);
+  if (data == NULL)
+    return NULL;
+  PyObject *ctor =
+      PyObject_GetAttrString((PyObject *)Py_TYPE(self), "deserialize");
+  if (ctor == NULL) {
+    Py_DECREF(data);
+    return NULL;
+  }
+  return Py_BuildValue("N(N)", ctor, data);
+}
 
-  bf->hashSeed = seed;
+static Py_ssize_t BloomFilter_len(PyBloomFilter *self) {
+  if (check_ready(self) != 0)
+    return -1;
+  return (Py_ssize_t)self->bf->size();
+}
 
-  return Py_BuildValue("");
+/*
+ * Buffer protocol: the bitmap is exported read-only and without copying, so
+ * it can be wrapped by numpy.frombuffer(), bytes() or memoryview() and copied
+ * into multiprocessing.shared_memory with a single memcpy. The exporter keeps
+ * the filter alive; the bitmap itself is never reallocated.
+ */
+static int BloomFilter_getbuffer(PyBloomFilter *self, Py_buffer *view,
+                                 int flags) {
+  if (check_ready(self) != 0) {
+    view->obj = NULL;
+    return -1;
+  }
+  return PyBuffer_FillInfo(view, (PyObject *)self,
+                           (void *)self->bf->bitmap(),
+                           (Py_ssize_t)self->bf->byte_size(), 1, flags);
 }
 
-static PyObject *wrapper_num_set_bits(PyObject *self, PyObject *args) {
-#ifdef COUNTING_SET_BITS_ON
-  struct bloom *bf;
-  if (!PyArg_ParseTuple(args, "l", &bf))
-    Py_RETURN_NONE;
+static PyMethodDef BloomFilter_methods[] = {
+    {"add", (PyCFunction)BloomFilter_add, METH_O,
+     "add(key) -- insert an int, str or bytes-like key"},
+    {"add_many", (PyCFunction)BloomFilter_add_many, METH_O,
+     "add_many(buffer) -- insert every 64-bit integer of a contiguous buffer "
+     "(e.g. a numpy uint64 array) with the GIL released"},
+    {"add_iter", (PyCFunction)BloomFilter_add_iter, METH_O,
+     "add_iter(iterable) -- insert every key produced by an iterable, "
+     "returns the number of keys inserted"},
+    {"add_file", (PyCFunction)(void (*)(void))BloomFilter_add_file,
+     METH_VARARGS | METH_KEYWORDS,
+     "add_file(path, sep=b'\\n') -- mmap a file and insert every non-empty "
+     "record, returns the number of records inserted"},
+    {"merge", (PyCFunction)BloomFilter_merge, METH_O,
+     "merge(other) -- union a filter of the same shape into this one"},
+    {"popcount", (PyCFunction)BloomFilter_popcount, METH_NOARGS,
+     "number of bits set"},
+    {"fpr", (PyCFunction)BloomFilter_fpr, METH_NOARGS,
+     "estimated false positive rate"},
+    {"reset", (PyCFunction)BloomFilter_reset, METH_NOARGS,
+     "remove all elements"},
+    {"num_hashes", (PyCFunction)BloomFilter_num_hashes, METH_NOARGS,
+     "number of hash functions"},
+    {"error", (PyCFunction)BloomFilter_error, METH_NOARGS,
+     "expected false positive rate"},
+    {"seed", (PyCFunction)BloomFilter_seed, METH_NOARGS, "hash seed"},
+    {"hash", (PyCFunction)BloomFilter_hash, METH_NOARGS,
+     "name of the hash function (murmur2, wyhash or xxh3)"},
+    {"print", (PyCFunction)BloomFilter_print, METH_NOARGS,
+     "print this bloom filter"},
+    {"serialize", (PyCFunction)BloomFilter_serialize, METH_NOARGS,
+     "serialize the filter into bytes (see bloom_serialize)"},
+    {"deserialize", (PyCFunction)BloomFilter_deserialize,
+     METH_O | METH_CLASS, "re-construct a filter from serialize() output"},
+    {"__reduce__", (PyCFunction)BloomFilter_reduce, METH_NOARGS, NULL},
+    {NULL, NULL} /* Sentinel */
+};
 
-  return Py_BuildValue("I", bf->num_set_bits);
-#else
-  Py_RETURN_NONE;
-#endif
-}
+static PySequenceMethods BloomFilter_as_sequence = {
+    (lenfunc)BloomFilter_len,          /* sq_length */
+    0,                                 /* sq_concat */
+    0,                                 /* sq_repeat */
+    0,                                 /* sq_item */
+    0,                                 /* was_sq_slice */
+    0,                                 /* sq_ass_item */
+    0,                                 /* was_sq_ass_slice */
+    (objobjproc)BloomFilter_contains,  /* sq_contains */
+};
 
-static PyObject *wrapper_fpr(PyObject *self, PyObject *args) {
-#ifdef COUNTING_SET_BITS_ON
-  struct bloom *bf;
-  if (!PyArg_ParseTuple(args, "l", &bf))
-    Py_RETURN_NONE;
+static PyBufferProcs BloomFilter_as_buffer = {
+    (getbufferproc)BloomFilter_getbuffer, /* bf_getbuffer */
+    NULL,                                 /* bf_releasebuffer */
+};
 
-  double fpr = pow((double)bf->num_set_bits / bf.bits, bf.hashes);
-  return Py_BuildValue("d", fpr);
-#else
-  Py_RETURN_NONE;
-#endif
-}
\ No newline at end of file
+/*
+ * Module definition
+ */
+static struct PyModuleDef bloommodule = {
+    PyModuleDef_HEAD_INIT, "bloom", /* name of module */
+    bloom_doc,                      /* module documentation, may be NULL */
+    -1, /* size of per-interpreter state of the module,
+           or -1 if the module keeps state in global variables. */
+    NULL};
+
+PyMODINIT_FUNC PyInit_bloom(void) {
+  PyBloomFilter_Type.tp_name = "bloom.BloomFilter";
+  PyBloomFilter_Type.tp_basicsize = sizeof(PyBloomFilter);
+  PyBloomFilter_Type.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE;
+  PyBloomFilter_Type.tp_doc = "BloomFilter(entries, error, seed=0, hash=None)";
+  PyBloomFilter_Type.tp_new = BloomFilter_new;
+  PyBloomFilter_Type.tp_init = (initproc)BloomFilter_init;
+  PyBloomFilter_Type.tp_dealloc = (destructor)BloomFilter_dealloc;
+  PyBloomFilter_Type.tp_methods = BloomFilter_methods;
+  PyBloomFilter_Type.tp_as_sequence = &BloomFilter_as_sequence;
+  PyBloomFilter_Type.tp_as_buffer = &BloomFilter_as_buffer;
+  if (PyType_Ready(&PyBloomFilter_Type) < 0)
+    return NULL;
+
+  PyObject *m = PyModule_Create(&bloommodule);
+  if (m == NULL)
+    return NULL;
+  Py_INCREF(&PyBloomFilter_Type);
+  if (PyModule_AddObject(m, "BloomFilter", (PyObject *)&PyBloomFilter_Type) <
+      0) {
+    Py_DECREF(&PyBloomFilter_Type);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
@@ -19,8 +19,6 @@ setup(
         'Topic :: Software Development :: Libraries',
         'Programming Language :: C',
         'Programming Language :: C++',
-        'Programming Language :: Python :: 2',
-        'Programming Language :: Python :: 2.7',
         'Programming Language :: Python :: 3',
         'Programming Language :: Python :: 3.4',
         'Programming Language :: Python :: 3.5',
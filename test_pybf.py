@@ -1,4 +1,10 @@
 #!/usr/bin/env python3
+import array
+import os
+import pickle
+import tempfile
+import threading
+
 from pybf import BloomFilter
 
 
@@ -61,9 +67,89 @@ def test_bf_str(num_items=1000000, error=0.01):
     print(f"False positive rate: {fpr}")
     print("Passed!")
 
+def test_bf_pickle(num_items=10000, error=0.01):
+    """Pickling round-trips through the serialized format"""
+    print(f"Bloom filter pickle test")
+    bf = BloomFilter(num_items, error, seed=9021)
+    for i in range(num_items):
+        bf.add(i)
+    copy = pickle.loads(pickle.dumps(bf))
+    assert copy.seed() == 9021
+    assert len(copy) == len(bf)
+    assert bytes(copy) == bytes(bf)
+    for i in range(num_items):
+        assert i in copy
+    # the hash function travels with the filter
+    bf = BloomFilter(num_items, error, hash="wyhash")
+    bf.add("key")
+    copy = pickle.loads(pickle.dumps(bf))
+    assert copy.hash() == "wyhash" and "key" in copy
+    print("Passed!")
+
+
+def test_bf_buffer(num_items=10000, error=0.01):
+    """The bitmap is exported read-only without copying"""
+    print(f"Bloom filter buffer test")
+    bf = BloomFilter(num_items, error)
+    view = memoryview(bf)
+    assert view.readonly
+    assert view.nbytes * 8 >= len(bf)
+    assert not any(view)
+    bf.add(42)
+    assert sum(bin(b).count("1") for b in view) == bf.popcount()
+    print("Passed!")
+
+
+def test_bf_add_many(num_items=100000, error=0.01, num_threads=4):
+    """Batch insert from several threads, then merge"""
+    print(f"Bloom filter add_many test")
+    bf = BloomFilter(num_items, error)
+    chunks = [array.array("Q", range(t, num_items, num_threads))
+              for t in range(num_threads)]
+    threads = [threading.Thread(target=bf.add_many, args=(c,)) for c in chunks]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    for i in range(num_items):
+        assert i in bf
+
+    other = BloomFilter(num_items, error)
+    other.add("merged")
+    bf.merge(other)
+    assert "merged" in bf
+    print("Passed!")
+
+
+def test_bf_streaming(num_items=100000, error=0.01):
+    """Bulk insertion from iterables and files"""
+    print(f"Bloom filter streaming test")
+    bf = BloomFilter(num_items, error)
+    assert bf.add_iter(str(i) for i in range(num_items // 2)) == num_items // 2
+    assert bf.add_iter([b"bytes", 7]) == 2
+
+    with tempfile.NamedTemporaryFile("w", delete=False) as fp:
+        for i in range(num_items // 2, num_items):
+            fp.write(f"{i}\n")
+        fp.write("\n")  # empty records are skipped
+    try:
+        assert bf.add_file(fp.name) == num_items - num_items // 2
+    finally:
+        os.unlink(fp.name)
+
+    for i in range(num_items):
+        assert str(i) in bf
+    assert b"bytes" in bf and 7 in bf
+    print("Passed!")
+
+
 if __name__ == "__main__":
     test_bf_int()
     test_bf_str()
+    test_bf_pickle()
+    test_bf_buffer()
+    test_bf_add_many()
+    test_bf_streaming()
 # import bloom
 
 
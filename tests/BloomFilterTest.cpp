@@ -1,6 +1,16 @@
 #include <gtest/gtest.h>
 #include <BloomFilter.h>
+#include <BitSlicedIndex.h>
+#include <BloomFilterPool.h>
+#include <CorrectedBloomFilter.h>
+#include <PagedBloomFilter.h>
+#include <RangeBloomFilter.h>
+#include <StaticBloomFilter.h>
+#include <TieredBloomFilter.h>
+#include <cctype>
 #include <cmath>
+#include <random>
+#include <thread>
 
 TEST(BloomFilterTest, ConsturctorArgumentsShouldBeValid) {
   EXPECT_NO_THROW(BloomFilter(1000, 0.2));
@@ -116,6 +126,623 @@ TEST(BloomFilter, FalsePositiveProbability) {
   printf("Expected false positive rate: %.8f, observed false positive rate: %.8f\n",bf.effective_fpp(), (double)cf / ct);
 }
 
+TEST(BloomFilterTest, SerializeRoundTrip) {
+  auto bf = BloomFilter(10000, 0.01, 9021);
+  for (int i = 0; i < 1000; ++i) bf.add(i);
+  auto data = bf.serialize();
+  EXPECT_EQ(bf.byte_size() + 48, data.size());
+
+  auto copy = BloomFilter::deserialize(data.data(), data.size());
+  EXPECT_EQ(bf.size(), copy.size());
+  EXPECT_EQ(bf.num_hashes(), copy.num_hashes());
+  EXPECT_EQ(bf.hash_seed(), copy.hash_seed());
+  EXPECT_TRUE(std::equal(bf.bitmap(), bf.bitmap() + bf.byte_size(),
+                         copy.bitmap()));
+  for (int i = 0; i < 1000; ++i) EXPECT_TRUE(copy.contains(i));
+
+  // truncated and corrupted buffers are rejected
+  EXPECT_THROW(BloomFilter::deserialize(data.data(), data.size() - 1),
+               std::runtime_error);
+  data[24] ^= 0x01u;  // bits
+  EXPECT_THROW(BloomFilter::deserialize(data.data(), data.size()),
+               std::runtime_error);
+}
+
+TEST(BloomFilterTest, CompressedRoundTrip) {
+  auto bf = BloomFilter(100000, 0.01, 9021);
+  for (int i = 0; i < 1000; ++i) bf.add(i);
+  auto raw = bf.serialize();
+  // lightly loaded: the gaps between set bits compress well
+  auto rice = bf.serialize_compressed();
+  EXPECT_EQ(3, rice[4]);
+  EXPECT_EQ(BLOOM_CODEC_RICE, rice[48]);
+  EXPECT_LT(rice.size() * 4, raw.size());
+  auto plain = bf.serialize_compressed(BLOOM_CODEC_RAW);
+  EXPECT_EQ(raw.size() + 16, plain.size());
+
+  for (const auto &data : {rice, plain}) {
+    auto copy = BloomFilter::deserialize(data.data(), data.size());
+    EXPECT_EQ(bf.hash_seed(), copy.hash_seed());
+    EXPECT_TRUE(std::equal(bf.bitmap(), bf.bitmap() + bf.byte_size(),
+                           copy.bitmap()));
+  }
+  EXPECT_THROW(BloomFilter::deserialize(rice.data(), rice.size() - 8),
+               std::runtime_error);
+
+  // at design load, Rice is no smaller than the bitmap
+  for (int i = 1000; i < 100000; ++i) bf.add(i);
+  EXPECT_EQ(BLOOM_CODEC_RAW, bf.serialize_compressed()[48]);
+  auto empty = BloomFilter(1000, 0.01);
+  auto data = empty.serialize_compressed();
+  EXPECT_EQ(48u + 16u, data.size());
+  EXPECT_EQ(0u, BloomFilter::deserialize(data.data(), data.size()).popcount());
+}
+
+TEST(BloomFilterTest, DeltaSync) {
+  auto primary = BloomFilter(100000, 0.01);
+  for (int i = 0; i < 50000; ++i) primary.add(i);
+  auto replica = primary;
+  auto stale = primary;
+  for (int i = 50000; i < 50100; ++i) primary.add(i);
+
+  auto delta = primary.diff(replica);
+  EXPECT_LT(delta.size() * 50, primary.byte_size());
+  replica.apply_delta(delta);
+  EXPECT_EQ(primary.checksum(), replica.checksum());
+  for (int i = 0; i < 50100; ++i) EXPECT_TRUE(replica.contains(i));
+
+  // a delta only applies to the version it was made from
+  EXPECT_THROW(replica.apply_delta(delta), std::runtime_error);
+  stale.add(-1);
+  uint64_t before = stale.checksum();
+  EXPECT_THROW(stale.apply_delta(delta), std::runtime_error);
+  EXPECT_EQ(before, stale.checksum());
+
+  // corrupted deltas leave the filter untouched
+  auto older = BloomFilter(100000, 0.01);
+  auto corrupt = primary.diff(older);
+  corrupt[60] ^= 0x10;  // payload
+  EXPECT_THROW(older.apply_delta(corrupt), std::runtime_error);
+  EXPECT_EQ(0u, older.popcount());
+
+  // deltas also undo resets
+  replica.reset();
+  auto undo = primary.diff(replica);
+  replica.apply_delta(undo);
+  EXPECT_EQ(primary.checksum(), replica.checksum());
+  EXPECT_THROW(primary.diff(BloomFilter(1000, 0.01)), std::runtime_error);
+}
+
+TEST(BloomFilterTest, MappedAllocationReset) {
+  for (auto alloc : {BLOOM_ALLOC_MMAP, BLOOM_ALLOC_HUGE}) {
+    auto bf = BloomFilter(100000, 0.01, alloc, 9021);
+    EXPECT_EQ(0u, bf.popcount());
+    for (int i = 0; i < 1000; ++i) bf.add(i);
+    auto copy = bf;
+    EXPECT_TRUE(std::equal(bf.bitmap(), bf.bitmap() + bf.byte_size(),
+                           copy.bitmap()));
+
+    bf.reset();
+    EXPECT_EQ(0u, bf.popcount());
+    EXPECT_FALSE(bf.contains(1));
+    bf.add(1);
+    EXPECT_TRUE(bf.contains(1));
+
+    // assigning over a mapped filter
+    bf = copy;
+    for (int i = 0; i < 1000; ++i) EXPECT_TRUE(bf.contains(i));
+  }
+  EXPECT_THROW(BloomFilter(1000, 0.01, (bloom_alloc) 7), std::runtime_error);
+
+  auto pow2 = BloomFilter::power_of_two(100000, 0.01, 0, BLOOM_ALLOC_MMAP);
+  for (int i = 0; i < 1000; ++i) pow2.add(i);
+  pow2.fold(8);
+  for (int i = 0; i < 1000; ++i) EXPECT_TRUE(pow2.contains(i));
+  pow2.reset();
+  EXPECT_EQ(0u, pow2.popcount());
+}
+
+TEST(BloomFilterTest, FoldPowerOfTwo) {
+  auto bf = BloomFilter::power_of_two(10000, 0.01, 77);
+  EXPECT_EQ(131072u, bf.size());
+  EXPECT_EQ(BloomFilter(10000, 0.01).num_hashes(), bf.num_hashes());
+  for (int i = 0; i < 2000; ++i) bf.add(i);
+
+  double expected = bf.fold_fpp(4);
+  auto folded = bf;
+  folded.fold(4);
+  EXPECT_EQ(32768u, folded.size());
+  EXPECT_EQ(4096u, folded.byte_size());
+  EXPECT_DOUBLE_EQ(expected, folded.effective_fpp());
+  for (int i = 0; i < 2000; ++i) EXPECT_TRUE(folded.contains(i));
+
+  // folding twice is folding once by the product
+  bf.fold(2);
+  bf.fold(2);
+  EXPECT_TRUE(std::equal(bf.bitmap(), bf.bitmap() + bf.byte_size(),
+                         folded.bitmap()));
+  bf.add(5000);
+  EXPECT_TRUE(bf.contains(5000));
+
+  auto data = folded.serialize();
+  auto loaded = BloomFilter::deserialize(data.data(), data.size());
+  EXPECT_EQ(folded.size(), loaded.size());
+  EXPECT_EQ(folded.hash_seed(), loaded.hash_seed());
+  for (int i = 0; i < 2000; ++i) EXPECT_TRUE(loaded.contains(i));
+
+  EXPECT_THROW(bf.fold(3), std::runtime_error);
+  EXPECT_THROW(bf.fold(1024), std::runtime_error);
+  EXPECT_THROW(BloomFilter(10000, 0.01).fold(2), std::runtime_error);
+  EXPECT_THROW(BloomFilter(10000, 0.01).fold_fpp(2), std::runtime_error);
+}
+
+TEST(BloomFilterTest, Merge) {
+  auto a = BloomFilter(10000, 0.01);
+  auto b = BloomFilter(10000, 0.01);
+  for (int i = 0; i < 100; ++i) a.add(i);
+  for (int i = 100; i < 200; ++i) b.add(i);
+  a.merge(b);
+  for (int i = 0; i < 200; ++i) EXPECT_TRUE(a.contains(i));
+
+  auto c = BloomFilter(20000, 0.01);
+  EXPECT_THROW(a.merge(c), std::runtime_error);
+}
+
+TEST(BloomFilterTest, AddMany) {
+  auto bf = BloomFilter(10000, 0.01);
+  std::vector<uint64_t> keys(1000);
+  for (size_t i = 0; i < keys.size(); ++i) keys[i] = i * 7919;
+  bf.add_many(keys.data(), keys.size());
+  for (auto key : keys) EXPECT_TRUE(bf.contains(key));
+
+  // large enough to be inserted region by region
+  auto big = BloomFilter(4000000, 0.01), one_by_one = big, parallel = big;
+  keys.resize(100000);
+  for (size_t i = 0; i < keys.size(); ++i) keys[i] = i * 7919;
+  big.add_many(keys.data(), keys.size());
+  for (auto key : keys) one_by_one.add(key);
+  EXPECT_TRUE(std::equal(big.bitmap(), big.bitmap() + big.byte_size(),
+                         one_by_one.bitmap()));
+
+  std::thread t([&]() { parallel.add_many_atomic(keys.data(), 50000); });
+  parallel.add_many_atomic(keys.data() + 50000, 50000);
+  t.join();
+  EXPECT_TRUE(std::equal(big.bitmap(), big.bitmap() + big.byte_size(),
+                         parallel.bitmap()));
+}
+
+TEST(BloomFilterTest, ConcurrentAtomicAdd) {
+  size_t items = 100000;
+  auto bf = BloomFilter(items, 0.01);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < 4; ++t) {
+    threads.emplace_back([&bf, t, items]() {
+      for (size_t i = t; i < items; i += 4) bf.add_atomic(i);
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  for (size_t i = 0; i < items; ++i) EXPECT_TRUE(bf.contains(i));
+
+  // atomic and plain inserts set the same bits
+  auto plain = BloomFilter(items, 0.01);
+  for (size_t i = 0; i < items; ++i) plain.add(i);
+  EXPECT_TRUE(std::equal(bf.bitmap(), bf.bitmap() + bf.byte_size(),
+                         plain.bitmap()));
+}
+
+TEST(BloomFilterTest, RuntimeStats) {
+  auto bf = BloomFilter(10000, 0.01);
+  EXPECT_THROW(bf.snapshot(), std::runtime_error);
+  bf.enable_stats();
+  for (uint64_t i = 0; i < 1000; ++i) bf.add(i);
+  size_t found = 0;
+  for (uint64_t i = 0; i < 2000; ++i) found += bf.contains(i);
+
+  auto snap = bf.snapshot();
+  EXPECT_EQ(1000u, snap.adds);
+  EXPECT_EQ(2000u, snap.lookups);
+  EXPECT_EQ(found, snap.positives);
+  uint64_t depths = 0;
+  for (auto n : snap.probe_depth) depths += n;
+  EXPECT_EQ(snap.lookups, depths);
+  EXPECT_GE(snap.probe_depth[bf.num_hashes() - 1], 1000u);
+  EXPECT_DOUBLE_EQ((double) bf.popcount() / bf.size(), snap.fill_ratio);
+
+  std::string text = bf.stats_prometheus("users");
+  EXPECT_NE(std::string::npos,
+            text.find("bloom_adds_total{filter=\"users\"} 1000\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("bloom_probe_depth_count{filter=\"users\"} 2000\n"));
+
+  // moved-from filters give up their statistics
+  auto moved = std::move(bf);
+  EXPECT_TRUE(moved.stats_enabled());
+  EXPECT_FALSE(bf.stats_enabled());
+  // copies start without statistics
+  auto copy = moved;
+  EXPECT_FALSE(copy.stats_enabled());
+}
+
+TEST(BloomFilterTest, HashSelection) {
+  auto murmur = BloomFilter(10000, 0.01);
+  auto wy = BloomFilter(10000, 0.01, BLOOM_HASH_WYHASH);
+  EXPECT_EQ(BLOOM_HASH_MURMUR2, murmur.hash());
+  EXPECT_STREQ("wyhash", wy.hash_name());
+  for (uint64_t i = 0; i < 1000; ++i) {
+    murmur.add(i);
+    wy.add(i);
+  }
+  for (uint64_t i = 0; i < 1000; ++i) EXPECT_TRUE(wy.contains(i));
+  EXPECT_FALSE(std::equal(wy.bitmap(), wy.bitmap() + wy.byte_size(),
+                          murmur.bitmap()));
+  EXPECT_THROW(murmur.merge(wy), std::runtime_error);
+
+  // murmur2 filters keep format version 1, other hashes need version 2
+  auto data = wy.serialize();
+  EXPECT_EQ(2, data[4]);
+  EXPECT_EQ(BLOOM_HASH_WYHASH, data[6]);
+  EXPECT_EQ(1, murmur.serialize()[4]);
+  auto copy = BloomFilter::deserialize(data.data(), data.size());
+  EXPECT_EQ(BLOOM_HASH_WYHASH, copy.hash());
+  for (uint64_t i = 0; i < 1000; ++i) EXPECT_TRUE(copy.contains(i));
+  auto assigned = murmur;
+  assigned = wy;
+  EXPECT_EQ(BLOOM_HASH_WYHASH, assigned.hash());
+  EXPECT_TRUE(assigned.contains(uint64_t(1)));
+
+  data[6] = BLOOM_HASH_COUNT;
+  EXPECT_THROW(BloomFilter::deserialize(data.data(), data.size()),
+               std::runtime_error);
+  if (!bloom_hash_available(BLOOM_HASH_XXH3)) {
+    EXPECT_THROW(BloomFilter(10000, 0.01, BLOOM_HASH_XXH3),
+                 std::runtime_error);
+  }
+}
+
+TEST(BloomFilterTest, PrecomputedHashes) {
+  std::vector<BloomFilter> tenants;
+  for (size_t i = 0; i < 8; ++i) tenants.emplace_back(1000 * (i + 1), 0.01);
+  std::vector<BloomFilter *> filters;
+  for (auto &bf : tenants) filters.push_back(&bf);
+  for (uint64_t i = 0; i < 100; ++i) tenants[i % 8].add(i);
+
+  std::vector<bool> found;
+  for (uint64_t i = 0; i < 100; ++i) {
+    auto h = tenants[0].key_hash(i);
+    // precomputed hashes probe the same bits as the key itself
+    EXPECT_TRUE(tenants[i % 8].contains_hash(h));
+    BloomFilter::contains_hash_many(h, filters, found);
+    EXPECT_EQ(8u, found.size());
+    for (size_t t = 0; t < 8; ++t) {
+      EXPECT_EQ(tenants[t].contains(i), (bool) found[t]);
+    }
+  }
+
+  auto bf = BloomFilter(1000, 0.01);
+  bf.add_hash(bf.key_hash(std::string("key")));
+  EXPECT_TRUE(bf.contains(std::string("key")));
+
+  // hashes of filters with another seed or hash function are rejected
+  auto seeded = BloomFilter(1000, 0.01, 9021);
+  auto h = seeded.key_hash(1);
+  EXPECT_THROW(bf.contains_hash(h), std::runtime_error);
+  EXPECT_THROW(bf.add_hash(h), std::runtime_error);
+  EXPECT_THROW(BloomFilter::contains_hash_many(h, filters, found),
+               std::runtime_error);
+}
+
+TEST(BloomFilterTest, RollingKmers) {
+  const unsigned k = 21;
+  std::mt19937 rng(7);
+  std::string read;
+  for (size_t i = 0; i < 2000; ++i) read += "ACGT"[rng() % 4];
+  std::string rc(read.rbegin(), read.rend());
+  for (char &c : rc) c = c == 'A' ? 'T' : c == 'C' ? 'G' : c == 'G' ? 'C' : 'A';
+
+  // the rolling hash matches hashing every k-mer from scratch, and both
+  // strands hash the same
+  NtHash kmers(read.c_str(), read.size(), k);
+  size_t n = 0;
+  while (kmers.next()) {
+    EXPECT_EQ(n, kmers.pos());
+    EXPECT_EQ(NtHash::kmer(read.c_str() + n, k), kmers.hash());
+    EXPECT_EQ(NtHash::kmer(rc.c_str() + read.size() - k - n, k), kmers.hash());
+    ++n;
+  }
+  EXPECT_EQ(read.size() - k + 1, n);
+
+  auto bf = BloomFilter(10000, 0.01);
+  EXPECT_EQ(n, bf.add_kmers(read, k));
+  EXPECT_EQ(n, bf.count_kmer_hits(read, k));
+  EXPECT_EQ(n, bf.count_kmer_hits(rc, k));
+  EXPECT_TRUE(bf.contains_kmer(read.c_str() + 100, k));
+
+  // k-mers with an unknown base are skipped, lower case is the same base
+  std::string masked = read.substr(0, 100);
+  masked[50] = 'N';
+  EXPECT_EQ(100 - 2 * k + 1, bf.count_kmer_hits(masked, k));
+  for (char &c : masked) c = (char) tolower(c);
+  EXPECT_EQ(100 - 2 * k + 1, bf.count_kmer_hits(masked, k));
+  EXPECT_EQ(0u, bf.count_kmer_hits(masked.substr(0, k - 1), k));
+
+  std::string other;
+  for (size_t i = 0; i < 10000; ++i) other += "ACGT"[rng() % 4];
+  EXPECT_LT(bf.count_kmer_hits(other, k), 300u);
+}
+
+TEST(BitSlicedIndexTest, QueryAddRemove) {
+  std::vector<BloomFilter> shards;
+  for (int s = 0; s < 100; ++s) {
+    shards.emplace_back(1000, 0.01);
+    for (int i = 0; i < 100; ++i) shards.back().add(s * 100 + i);
+  }
+  BitSlicedIndex index(shards[0], 16);
+  for (auto &bf : shards) index.add(bf);
+  EXPECT_EQ(100u, index.members());
+  EXPECT_EQ(128u, index.capacity());
+
+  // the index answers what contains() on every shard answers
+  for (int key = 0; key < 10000; key += 37) {
+    std::vector<size_t> expected;
+    for (size_t s = 0; s < shards.size(); ++s) {
+      if (shards[s].contains(key)) expected.push_back(s);
+    }
+    EXPECT_EQ(expected, index.matches(key));
+    EXPECT_EQ(expected, index.matches(shards[0].key_hash(key)));
+  }
+
+  index.remove(42);
+  EXPECT_FALSE(index.contains_member(42));
+  EXPECT_TRUE(index.matches(4200).empty());
+  EXPECT_THROW(index.remove(42), std::runtime_error);
+  EXPECT_EQ(42u, index.add(shards[7]));
+  EXPECT_EQ((std::vector<size_t>{7, 42}), index.matches(700));
+
+  auto other = BloomFilter(2000, 0.01);
+  EXPECT_THROW(index.add(other), std::runtime_error);
+  auto seeded = BloomFilter(1000, 0.01, 9021);
+  EXPECT_THROW(index.query(seeded.key_hash(1)), std::runtime_error);
+}
+
+TEST(BitSlicedIndexTest, SaveAndMap) {
+  auto bf = BloomFilter(1000, 0.01, 9021);
+  for (int i = 0; i < 100; ++i) bf.add(i);
+  BitSlicedIndex index(bf);
+  index.add(bf);
+  index.add(bf);
+  index.remove(0);
+
+  std::string path = ::testing::TempDir() + "bit_sliced_index.bin";
+  index.save(path);
+  auto mapped = BitSlicedIndex::open(path);
+  std::remove(path.c_str());  // the mapping stays valid
+  EXPECT_EQ(1u, mapped.members());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(std::vector<size_t>{1}, mapped.matches(i));
+  }
+  EXPECT_EQ(index.query(std::string("absent")),
+            mapped.query(std::string("absent")));
+  EXPECT_THROW(mapped.add(bf), std::runtime_error);
+  EXPECT_THROW(BitSlicedIndex::open(path), std::runtime_error);
+}
+
+TEST(BloomFilterPoolTest, SlotsBehaveLikeFilters) {
+  BloomFilterPool pool(200, 0.01, 4, 9021);
+  std::vector<size_t> ids;
+  for (int u = 0; u < 10; ++u) ids.push_back(pool.allocate());
+  EXPECT_EQ(10u, pool.size());
+  EXPECT_EQ(16u, pool.capacity());  // grew twice, keeping the contents
+  for (int u = 0; u < 10; ++u) {
+    for (uint64_t i = 0; i < 100; ++i) pool.add(ids[u], u * 1000 + i);
+  }
+
+  // a slot holds the bitmap of an equivalent BloomFilter
+  auto bf = BloomFilter(200, 0.01, 9021);
+  for (uint64_t i = 0; i < 100; ++i) bf.add(3000 + i);
+  EXPECT_EQ(bf.byte_size(), pool.byte_size());
+  EXPECT_TRUE(std::equal(bf.bitmap(), bf.bitmap() + bf.byte_size(),
+                         pool.bitmap(ids[3])));
+  EXPECT_TRUE(pool.contains_hash(ids[3], bf.key_hash(uint64_t(3042))));
+
+  std::vector<size_t> lookup_ids;
+  std::vector<uint64_t> keys;
+  for (int u = 0; u < 10; ++u) {
+    for (uint64_t i = 0; i < 200; i += 7) {
+      lookup_ids.push_back(ids[u]);
+      keys.push_back(u * 1000 + i);
+    }
+  }
+  std::unique_ptr<bool[]> found(new bool[keys.size()]);
+  size_t positives = pool.contains_many(lookup_ids.data(), keys.data(),
+                                        keys.size(), found.get());
+  size_t expected = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(pool.contains(lookup_ids[i], keys[i]), found[i]);
+    if (keys[i] % 1000 < 100) {
+      EXPECT_TRUE(found[i]);
+    }
+    expected += found[i];
+  }
+  EXPECT_EQ(expected, positives);
+
+  // released slots are recycled empty
+  pool.release(ids[5]);
+  EXPECT_THROW(pool.contains(ids[5], 1), std::runtime_error);
+  EXPECT_THROW(pool.release(ids[5]), std::runtime_error);
+  EXPECT_EQ(ids[5], pool.allocate());
+  EXPECT_FALSE(pool.contains(ids[5], uint64_t(5000)));
+  EXPECT_TRUE(pool.contains(ids[6], uint64_t(6000)));
+  pool.reset(ids[6]);
+  EXPECT_FALSE(pool.contains(ids[6], uint64_t(6000)));
+  EXPECT_THROW(pool.add(100, 1), std::runtime_error);
+  EXPECT_THROW(pool.add_hash(ids[0], BloomFilter(200, 0.01).key_hash(1)),
+               std::runtime_error);
+}
+
+TEST(PagedBloomFilterTest, CachedPagesAndReopen) {
+  std::string path = ::testing::TempDir() + "paged_bloom_filter.bin";
+  std::vector<uint64_t> keys(20000), absent(20000);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    keys[i] = i * 7919;
+    absent[i] = i * 7919 + 1;
+  }
+  {
+    // a cache of 4 pages, too few to hold all 6
+    auto bf = PagedBloomFilter::create(path, 20000, 0.01, 4, 9021);
+    EXPECT_EQ(6u, bf.pages());
+    bf.add_many(keys.data(), 10000);
+    for (size_t i = 10000; i < keys.size(); ++i) bf.add(keys[i]);
+    bf.add(std::string("string key"));
+    for (uint64_t key : keys) EXPECT_TRUE(bf.contains(key));
+    EXPECT_GT(bf.page_writes(), 0u);  // evicted while dirty
+  }
+
+  auto bf = PagedBloomFilter::open(path, 16, 2);
+  EXPECT_EQ(9021u, bf.hash_seed());
+  std::unique_ptr<bool[]> found(new bool[keys.size()]);
+  EXPECT_EQ(keys.size(), bf.contains_many(keys.data(), keys.size(),
+                                          found.get()));
+  EXPECT_TRUE(bf.contains(std::string("string key")));
+  EXPECT_EQ(bf.pages(), bf.page_reads());  // all cached after one batch
+  size_t positives = bf.contains_many(absent.data(), absent.size(),
+                                      found.get());
+  EXPECT_LT(positives, absent.size() * 2 / 100);
+  EXPECT_EQ(bf.pages(), bf.page_reads());
+
+  std::remove(path.c_str());
+  EXPECT_THROW(PagedBloomFilter::open(path), std::runtime_error);
+}
+
+TEST(RangeBloomFilterTest, PointsAndRanges) {
+  RangeBloomFilter bf(1000, 0.01, 12);
+  std::vector<uint64_t> keys;
+  for (uint64_t i = 1; i <= 1000; ++i) keys.push_back(i << 20u);
+  bf.add_many(keys.data(), keys.size() / 2);
+  for (size_t i = keys.size() / 2; i < keys.size(); ++i) bf.add(keys[i]);
+
+  for (uint64_t key : keys) {
+    EXPECT_TRUE(bf.contains(key));
+    EXPECT_TRUE(bf.may_contain_range(key, key));
+    EXPECT_TRUE(bf.may_contain_range(key - 1000, key + 1000));
+    EXPECT_TRUE(bf.may_contain_range(key - 12345, key));
+    EXPECT_TRUE(bf.may_contain_range(key, key + 54321));
+  }
+  // empty ranges between the keys, of 1 to 2^16 keys
+  size_t positives = 0, queries = 0;
+  for (uint64_t key : keys) {
+    for (uint64_t len = 1; len < (1u << 16u); len *= 3) {
+      positives += bf.may_contain_range(key + 1, key + len);
+      queries++;
+    }
+  }
+  EXPECT_LT(positives, queries * 5 / 100);
+  EXPECT_FALSE(bf.may_contain_range(5, 4));
+  EXPECT_TRUE(bf.may_contain_range(0, UINT64_MAX));  // too wide to probe
+  EXPECT_THROW(RangeBloomFilter(1000, 0.01, 0), std::runtime_error);
+}
+
+TEST(StaticBloomFilterTest, CompileTimeShape) {
+  // the shape of bloom_init(), as constant expressions
+  static_assert(static_bloom_bits(1000, 0.01) == 9586, "bits");
+  static_assert(static_bloom_hashes(0.01) == 7, "hashes");
+  for (double error : {0.5, 0.1, 0.05, 0.01, 0.001, 1e-4, 1e-6, 1e-9}) {
+    for (size_t entries : {1, 7, 1000, 12345, 1000000, 123456789}) {
+      struct bloom shape;
+      bloom_init_wo_allocation(&shape, entries, error);
+      EXPECT_EQ(shape.bits, static_bloom_bits(entries, error));
+      EXPECT_EQ((unsigned) shape.hashes, static_bloom_hashes(error));
+    }
+  }
+
+  typedef StaticBloomFilter<static_bloom_bits(1000, 0.01),
+                            static_bloom_hashes(0.01)> Filter;
+  auto bf = BloomFilter(1000, 0.01, 9021);
+  for (int i = 0; i < 1000; ++i) bf.add(i);
+  bf.add(std::string("key"));
+  static unsigned char bitmap[Filter::BYTES];
+  ASSERT_EQ(sizeof(bitmap), bf.byte_size());
+  std::copy(bf.bitmap(), bf.bitmap() + bf.byte_size(), bitmap);
+
+  // probes the same bits as the filter it was built from
+  const Filter fixed(bitmap, bf.hash_seed());
+  EXPECT_EQ(bf.size(), fixed.size());
+  EXPECT_EQ(bf.num_hashes(), fixed.num_hashes());
+  EXPECT_TRUE(fixed.contains(std::string("key")));
+  for (int i = 0; i < 2000; ++i) EXPECT_EQ(bf.contains(i), fixed.contains(i));
+}
+
+TEST(CorrectedBloomFilterTest, KnownFalsePositives) {
+  auto bf = CorrectedBloomFilter(1000, 0.05);
+  for (int i = 0; i < 1000; ++i) bf.add(i);
+  std::vector<int> false_positives;
+  for (int i = 1000; i < 100000; ++i) {
+    if (bf.contains(i)) false_positives.push_back(i);
+  }
+  ASSERT_GT(false_positives.size(), 100u);
+  for (int i : false_positives) EXPECT_TRUE(bf.add_false_positive(i));
+  EXPECT_EQ(false_positives.size(), bf.false_positives());
+  for (int i = 1000; i < 100000; ++i) EXPECT_FALSE(bf.contains(i));
+  // a key the filter rejects needs no correction
+  int negative = 1000;
+  while (std::count(false_positives.begin(), false_positives.end(), negative)) {
+    ++negative;
+  }
+  EXPECT_FALSE(bf.add_false_positive(negative));
+  EXPECT_EQ(false_positives.size(), bf.false_positives());
+  for (int i = 0; i < 1000; ++i) EXPECT_TRUE(bf.contains(i));
+
+  // adding a corrected key makes it a member again; the others stay
+  // corrected
+  for (size_t i = 0; i < false_positives.size(); i += 2) {
+    bf.add(false_positives[i]);
+  }
+  EXPECT_EQ(false_positives.size() / 2, bf.false_positives());
+  for (size_t i = 0; i < false_positives.size(); ++i) {
+    EXPECT_EQ(i % 2 == 0, bf.contains(false_positives[i]));
+  }
+
+  auto data = bf.serialize();
+  auto copy = CorrectedBloomFilter::deserialize(data);
+  EXPECT_EQ(bf.false_positives(), copy.false_positives());
+  for (int i = 0; i < 100000; ++i) EXPECT_EQ(bf.contains(i), copy.contains(i));
+  EXPECT_THROW(CorrectedBloomFilter::deserialize(data.data(), data.size() - 8),
+               std::runtime_error);
+  data[0] ^= 0x01u;
+  EXPECT_THROW(CorrectedBloomFilter::deserialize(data), std::runtime_error);
+}
+
+TEST(TieredBloomFilterTest, SummaryRejectsNegatives) {
+  auto bf = TieredBloomFilter(100000, 0.01, 100000);
+  // the large filter on its own
+  auto plain = BloomFilter(100000, 0.01, BLOOM_ALLOC_HEAP);
+  EXPECT_EQ(65536u, bf.summary().byte_size());
+  EXPECT_EQ(plain.byte_size(), bf.filter().byte_size());
+  EXPECT_EQ(bf.filter().byte_size() + 65536u, bf.byte_size());
+  for (int i = 0; i < 100000; ++i) {
+    bf.add(i);
+    plain.add(i);
+  }
+  for (int i = 0; i < 100000; ++i) EXPECT_TRUE(bf.contains(i));
+
+  // about 5 bits per key: the summary rejects most negatives by itself
+  EXPECT_LT(bf.summary_fpp(), 0.15);
+  EXPECT_NEAR(bf.summary_fpp() * bf.filter().effective_fpp(),
+              bf.effective_fpp(), 1e-12);
+  size_t tiered = 0, large = 0;
+  for (int i = 100000; i < 1100000; ++i) {
+    bool positive = bf.contains(i);
+    // positives of both levels are positives of the large filter
+    EXPECT_TRUE(!positive || plain.contains(i));
+    tiered += positive;
+    large += plain.contains(i);
+  }
+  EXPECT_LT(tiered, large);
+  EXPECT_LT((double) tiered / 1000000, 2 * bf.effective_fpp() + 1e-4);
+
+  bf.reset();
+  EXPECT_FALSE(bf.contains(1));
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
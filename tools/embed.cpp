@@ -0,0 +1,128 @@
+// Generate a C++ header embedding a bloom filter of fixed keys in a binary.
+//
+// Every line of KEYFILE is a key (empty lines are skipped). The keys are
+// added to a BloomFilter of CAPACITY items (default: the number of keys) at
+// false positive rate ERROR, whose bitmap is written to OUTPUT as a constant
+// array along with a StaticBloomFilter named NAME over it, its shape
+// computed at compile time with static_bloom_bits() and
+// static_bloom_hashes(). Include OUTPUT from one translation unit and call
+// NAME.contains(key). See the bloom_embed_filter() CMake function.
+//
+//   bf_embed -n NAME [-e ERROR] [-c CAPACITY] [-s SEED] [-H HASH]
+//            [-o OUTPUT] KEYFILE
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "BloomFilter.h"
+#include "StaticBloomFilter.h"
+
+using namespace std;
+
+const char *HASH_ENUMS[] = {"BLOOM_HASH_MURMUR2", "BLOOM_HASH_WYHASH",
+                            "BLOOM_HASH_XXH3"};
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bf_embed -n NAME [-e ERROR] [-c CAPACITY] [-s SEED] "
+          "[-H HASH] [-o OUTPUT] KEYFILE\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  const char *name = NULL, *output = NULL, *keyfile = NULL;
+  double error = 0.01;
+  size_t capacity = 0;
+  unsigned seed = 0;
+  int hash = BLOOM_HASH_MURMUR2;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] != '-') {
+      keyfile = argv[i];
+      continue;
+    }
+    if (i + 1 >= argc) usage();
+    if (!strcmp(argv[i], "-n")) {
+      name = argv[++i];
+    } else if (!strcmp(argv[i], "-e")) {
+      error = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-c")) {
+      capacity = (size_t) atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-s")) {
+      seed = (unsigned) strtoul(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "-H")) {
+      ++i;
+      for (hash = 0; hash < BLOOM_HASH_COUNT; ++hash) {
+        if (!strcmp(argv[i], bloom_hash_name(hash))) break;
+      }
+      if (hash == BLOOM_HASH_COUNT || !bloom_hash_available(hash)) {
+        fprintf(stderr, "Hash function %s not available\n", argv[i]);
+        exit(1);
+      }
+    } else if (!strcmp(argv[i], "-o")) {
+      output = argv[++i];
+    } else {
+      usage();
+    }
+  }
+  if (name == NULL || keyfile == NULL) usage();
+
+  ifstream in(keyfile);
+  if (!in) {
+    fprintf(stderr, "Failed to open file %s\n", keyfile);
+    exit(1);
+  }
+  vector<string> keys;
+  for (string line; getline(in, line);) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (!line.empty()) keys.push_back(line);
+  }
+  size_t entries = capacity > 0 ? capacity : max<size_t>(keys.size(), 1);
+
+  BloomFilter bf(entries, error, (bloom_hash) hash, seed);
+  if (bf.size() != static_bloom_bits(entries, error) ||
+      bf.num_hashes() != static_bloom_hashes(error)) {
+    fprintf(stderr, "Compile-time shape differs from bloom_init() for %lu "
+                    "entries at %g\n", (unsigned long) entries, error);
+    exit(1);
+  }
+  for (const string &key : keys) bf.add(key);
+
+  FILE *fp = output ? fopen(output, "w") : stdout;
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to create file %s\n", output);
+    exit(1);
+  }
+  string guard = string(name) + "_BLOOM_H_";
+  for (char &c : guard) c = (char) toupper((unsigned char) c);
+  const char *base = strrchr(keyfile, '/');
+  fprintf(fp, "// Generated by bf_embed from %s (%lu keys). Do not edit.\n\n",
+          base ? base + 1 : keyfile, (unsigned long) keys.size());
+  fprintf(fp, "#ifndef %s\n#define %s\n\n", guard.c_str(), guard.c_str());
+  fprintf(fp, "#include \"StaticBloomFilter.h\"\n\n");
+  fprintf(fp,
+          "typedef StaticBloomFilter<static_bloom_bits(%lu, %.17g),\n"
+          "                          static_bloom_hashes(%.17g)>\n"
+          "    %s_filter;\n\n",
+          (unsigned long) entries, error, error, name);
+  fprintf(fp, "alignas(64) static constexpr unsigned char %s_bitmap[] = {",
+          name);
+  const unsigned char *bits = bf.bitmap();
+  for (size_t i = 0; i < bf.byte_size(); ++i) {
+    fprintf(fp, "%s0x%02x,", i % 12 ? " " : "\n    ", bits[i]);
+  }
+  fprintf(fp, "\n};\n");
+  fprintf(fp,
+          "static_assert(sizeof(%s_bitmap) == %s_filter::BYTES,\n"
+          "              \"bitmap does not match the filter shape\");\n\n",
+          name, name);
+  fprintf(fp, "static constexpr %s_filter %s(%s_bitmap, %uu, %s);\n\n", name,
+          name, name, bf.hash_seed(), HASH_ENUMS[hash]);
+  fprintf(fp, "#endif // %s\n", guard.c_str());
+  if (fp != stdout) fclose(fp);
+}